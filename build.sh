@@ -2,6 +2,6 @@
 
 set -e
 xxd -n std -i std.s24 > std.c
-gcc -lm s24.c -o s24
+gcc -lm s24.c -o s24 -pthread
 # -fsanitize=address -g
 
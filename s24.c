@@ -5,126 +5,542 @@
 #include <string.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
 #include <unistd.h>
 #include <libgen.h>
+#include <time.h>
+#include <setjmp.h>
+#ifndef __EMSCRIPTEN__
+#include <pthread.h>
+#endif
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 #include "std.c"
 
 #define max_token_len 256
-#define token_stride max_token_len
 #define max_tokens 300
 #define max_stack 1000
-#define max_vars 100
-#define program_max_tokens tokens + token_count*max_token_len
+#define max_roots 1000
+#define gc_initial_threshold (8 * 1024 * 1024)
 
 
+// constant fica por último: no nanbox ela nunca vai para a etiqueta, que só
+// tem espaço para oito. bits divide a etiqueta 0 com null, que é sempre o
+// payload zero.
 typedef enum {
-    value_null, constant, operation, nest, array, character, string
+    value_null, nest, array, character, string, numbers, view, lazy, bits, constant
 } value_type;
 
+// numbers é um array de constantes empacotado, view uma janela sobre um
+// numbers, lazy uma conta ainda não feita e bits um array de 0 e 1 com um
+// bit por elemento. pro usuário são todos só arrays.
 char* type_string[] = {
-    "null", "constant", "operation", "nest", "array", "character", "string",
+    "null", "nest", "array", "character", "string", "array", "array", "array", "array", "constant",
 };
 
+typedef enum {
+    op_nop, op_paren_close, op_label, op_loop,
+    op_constant, op_string, op_nest, op_nest_end, op_word,
+    op_pop, op_sum, op_sub, op_mul, op_div, op_not, op_equal, op_or, op_and, op_min, op_max,
+    op_assign, op_assign_exec, op_branch, op_do, op_over, op_end, op_pick, op_size,
+    op_at, op_abs, op_pp, op_nl, op_fmt, op_ps, op_pv, op_idx, op_idx2,
+    op_dup, op_mod, op_list, op_pow, op_round, op_mask, op_rdl, op_acc,
+    op_rev, op_clr, op_ipr, op_x, op_rx, op_unb, op_ld, op_sws, op_ss,
+    op_a2n, op_gt0, op_lt0, op_binary_broadcast, op_unary_broadcast,
+    op_cos, op_sin, op_exp, op_log, op_sqrt, op_tr, op_col, op_slc, op_fac,
+    op_ran, op_ran2, op_fll,
+} opcode;
+
+// uma instrução por token, então uma nest é só um pedaço do código compilado.
+// nests nunca são copiadas nem liberadas, o programa vive até o fim.
+typedef struct instruction {
+    opcode op;
+    int arg;
+    int jump;  // distância até o destino, resolvida no load
+    int token; // símbolo
+} instruction;
+
+#ifdef S24_NANBOX
+
+// 8 bytes por valor. doubles ficam como estão e o resto mora dentro de um NaN:
+// sinal, expoente e bit quieto ligados, 3 bits de tipo e 48 de payload. o
+// tamanho de arrays e strings fica no cabeçalho do objeto, e uma nest é um
+// ponteiro para o seu '['.
+typedef struct value {
+    uint64_t bits;
+} value;
+
+#else
+
 typedef struct value {
     value_type type;
     union {
         double constant;
         char c;
         struct value* array;
-        char* nest;
+        double* numbers;
+        char* bytes; // strings, sempre terminadas em '\0'
+        void* payload;
+        instruction* nest;
     } data;
     int size;
-    bool auto_exec;
 } value;
 
+#endif
+
+// todo buffer de array, numbers e string tem um contador de referências
+// escondido logo antes dele. dup, -> e #N só somam no contador, e quem
+// for escrever num buffer compartilhado copia antes (make_unique).
+// o cabeçalho também põe o objeto na lista que o coletor varre.
+typedef struct object {
+    struct object* prev;
+    struct object* next;
+    size_t size;     // em bytes
+    size_t capacity; // o que foi pedido ao malloc, arrays crescem dobrando
+    int refs;
+    bool marked;
+    bool shared; // lido por vários workers de um broadcast em paralelo
+} __attribute__((aligned(16))) object;
+
+#define header(payload) ((object*) (payload) - 1)
+
+// rank/shape/stride sobre o buffer de um numbers. matrizes são uma view só,
+// e at, rev, tr, col e slc montam outra em cima do mesmo buffer sem copiar.
+#define max_rank 8
+
+typedef struct layout {
+    value base;   // numbers dono dos dados
+    double* data; // primeiro elemento
+    int rank;
+    int shape[max_rank];
+    int stride[max_rank]; // em doubles, pode ser negativo
+} layout;
+
+#define as_layout(v) ((layout*) as_payload(v))
+
+// conta elemento a elemento adiada. os operandos são numbers, constantes ou
+// outras lazy, e quem consome o valor força a cadeia toda num laço só.
+// ranges são lazy sem operando nenhum.
+typedef struct deferred {
+    value x, y; // y é null nas unárias, os dois nos ranges
+    void (*binary)(double*, double*, double*, int, int, int);
+    double (*numeric)(double, double);
+    void (*unary)(double*, double*, int);
+    double from, step; // ranges: o elemento i é from + i * step
+    int size, depth;
+    value result; // null até ser forçada, depois só ele vale
+} deferred;
+
+#define as_deferred(v) ((deferred*) as_payload(v))
+
+// bits: a quantidade num uint64_t e depois as palavras, o elemento i é o bit
+// i%64 da palavra i/64. o que passa do fim fica sempre em zero.
+#define as_words(v) ((uint64_t*) as_payload(v) + 1)
+#define bit_at(v, i) ((as_words(v)[(i) >> 6] >> ((i) & 63)) & 1)
+#define word_count(size) (((size) + 63) >> 6)
+
+// todo acesso a um value passa por aqui, para as duas representações
+#ifdef S24_NANBOX
+
+#define tag_mask 0xFFF8000000000000ull
+#define payload_mask 0x0000FFFFFFFFFFFFull
+#define canonical_nan 0x7FF8000000000000ull
+
+static inline value box(value_type type, uint64_t payload)
+{
+    return (value) { tag_mask | (uint64_t) type << 48 | payload };
+}
+
+static inline value_type type_of(value v)
+{
+    if ((v.bits & tag_mask) != tag_mask)
+        return constant;
+    value_type t = (v.bits >> 48) & 7;
+    if (t == value_null && (v.bits & payload_mask) != 0)
+        return bits;
+    return t;
+}
+
+static inline double as_constant(value v)
+{
+    double d;
+    memcpy(&d, &v.bits, sizeof(d));
+    return d;
+}
+
+static inline void* as_payload(value v)
+{
+    return (void*) (uintptr_t) (v.bits & payload_mask);
+}
+
+#define as_char(v) ((char) (v).bits)
+#define as_array(v) ((value*) as_payload(v))
+#define as_numbers(v) ((double*) as_payload(v))
+#define as_bytes(v) ((char*) as_payload(v))
+#define as_nest(v) ((instruction*) as_payload(v) + 1)
+
+static inline int size_of(value v)
+{
+    switch (type_of(v))
+    {
+        case array:
+            return header(as_payload(v))->size / sizeof(value);
+        case numbers:
+            return header(as_payload(v))->size / sizeof(double);
+        case string:
+            return header(as_payload(v))->size - 1;
+        case nest:
+            return ((instruction*) as_payload(v))->jump - 1;
+        case view:
+            return as_layout(v)->shape[0];
+        case lazy:
+            return as_deferred(v)->size;
+        case bits:
+            return *(uint64_t*) as_payload(v);
+        default:
+            return 0;
+    }
+}
+
+value new_character(char c)
+{
+    return box(character, (unsigned char) c);
+}
+
+// NaNs vindos de contas são normalizados para não parecerem um tipo
+value new_constant(double c)
+{
+    if (c != c)
+        return (value) { canonical_nan };
+
+    value v;
+    memcpy(&v.bits, &c, sizeof(c));
+    return v;
+}
+
+value new_nest(instruction* bracket)
+{
+    return box(nest, (uintptr_t) bracket);
+}
+
+value new_null()
+{
+    return box(value_null, 0);
+}
+
+// o tamanho já está no cabeçalho de payload
+value box_object(value_type type, void* payload, int size)
+{
+    (void) size;
+    return box(type, (uintptr_t) payload);
+}
+
+#else
+
+#define type_of(v) ((v).type)
+#define size_of(v) ((v).size)
+#define as_constant(v) ((v).data.constant)
+#define as_char(v) ((v).data.c)
+#define as_payload(v) ((v).data.payload)
+#define as_array(v) ((v).data.array)
+#define as_numbers(v) ((v).data.numbers)
+#define as_bytes(v) ((v).data.bytes)
+#define as_nest(v) ((v).data.nest)
+
+value new_character(char c)
+{
+    return (value) 
+        {
+            .type = character,
+            .data.c = c,
+            .size = 0
+        };
+}
+
+value new_constant(double c)
+{
+    return (value) 
+        {
+            .type = constant,
+            .data.constant = c,
+            .size = 0
+        };
+}
+
+value new_nest(instruction* bracket)
+{
+    return (value) { 
+        .type = nest, 
+        .data.nest = bracket + 1,
+        .size = bracket->jump - 1,
+    };
+}
+
+value new_null()
+{
+    return (value) { .type = value_null };
+}
+
+value box_object(value_type type, void* payload, int size)
+{
+    return (value) { 
+        .type = type, 
+        .data.payload = payload,
+        .size = size,
+    };
+}
+
+#endif
+
 typedef value s24_array;
 typedef value s24_nest;
 typedef value s24_constant;
 typedef value s24_string;
 
 
-int stack_size = 0;
-value stack[max_stack];
 int stack_print_limit = 12;
 
-int token_count = 0;
+// nomes internados. cada token vira um id e as variáveis moram no próprio
+// símbolo, então execute() nunca compara strings.
+typedef struct symbol {
+    int name; // offset em symbol_names
+    unsigned int hash;
+    bool defined;
+    bool auto_exec; // definido com !->
+    value data;
+} symbol;
+
+typedef struct chunk {
+    struct chunk* prev;
+    size_t used, capacity;
+} __attribute__((aligned(16))) chunk;
+
+typedef struct region_mark {
+    chunk* c;
+    size_t used;
+} region_mark;
+
+#define region_chunk_size (64 * 1024)
+
+// valores que builtins seguram em variáveis C enquanto chamam execute()
+typedef struct root {
+    value* values;
+    int count;
+} root;
+
+typedef struct gc_stats {
+    bool print;
+    size_t heap, peak, threshold;
+    int collections;
+    size_t freed_objects, freed_bytes;
+    clock_t time;
+} gc_stats;
+
+// código compilado de um load, vive enquanto a vm viver
+typedef struct program {
+    struct program* prev;
+    instruction* code;
+    int* tokens;
+    int size;
+} program;
+
+// todo o estado de um interpretador. nada disso é global, então dá pra ter
+// várias vms no mesmo processo, uma por thread.
+typedef struct s24_vm {
+    value stack[max_stack];
+    int stack_size;
+
+    // só nos workers de um broadcast: abaixo de stack_floor a pilha é
+    // emprestada da vm que chamou, e bail volta pro broadcast em série
+    int stack_floor;
+    jmp_buf* bail;
+    // quem roda o programa espera aqui pelos erros, ver run_from_stream
+    jmp_buf* fail;
+
+    symbol* symbols;
+    int symbol_count;
+    int symbol_capacity;
+
+    // arena com o texto de todos os símbolos, um atrás do outro
+    char* symbol_names;
+    int symbol_names_size;
+    int symbol_names_capacity;
+
+    // endereçamento aberto, guarda id+1 (0 é vazio)
+    int* symbol_slots;
+    int symbol_slots_size;
+
+    // literais já prontos, montados uma vez no load
+    value* constants;
+    int constant_count;
+    int constant_capacity;
+
+    s24_nest broadcast;
+
+    chunk* region;
+    object* objects;
+    gc_stats gc;
+    root roots[max_roots];
+    int root_count;
+
+    program* programs;
+    FILE* out; // pp, ps, pv e o resultado final
+} s24_vm;
+
+// num worker de um broadcast o erro não sai daqui: o broadcast desiste e
+// roda em série, que imprime tudo o que vinha antes e para no mesmo erro
+void bail(s24_vm* vm)
+{
+    if (vm->bail != NULL)
+        longjmp(*vm->bail, 1);
+}
+
+// erro do programa: volta para run_from_stream em vez de derrubar o
+// processo com todas as outras vms
+_Noreturn void fail(s24_vm* vm)
+{
+    bail(vm);
+    if (vm->fail != NULL)
+        longjmp(*vm->fail, 1);
+    exit(1);
+}
 
-int var_count = 0;
-char* var_names[max_vars];
-value var_data[max_vars];
+char* symbol_name(s24_vm* vm, int id)
+{
+    return vm->symbol_names + vm->symbols[id].name;
+}
 
-void execute(char*, int);
+void execute(s24_vm*, instruction*, int);
 
 
 
 bool is_constant(value array)
 {
-    return array.type == constant;
+    return type_of(array) == constant;
 }
 
 bool is_char(value array)
 {
-    return array.type == character;
+    return type_of(array) == character;
 }
 
 bool is_string(value array)
 {
-    return array.type == string;
+    return type_of(array) == string;
 }
 
-char* get_string(value string)
+#define max(x, y) x > y ? x : y
+#define min(x, y) x < y ? x : y
+
+bool is_array(value v)
 {
-    assert(is_string(string));
+    value_type t = type_of(v);
+    return t == array || t == string || t == numbers || t == view || t == bits 
+        || t == lazy;
+}
 
-    char* ret = malloc(sizeof(char) * string.size + 1);
-    for (int i = 0; i < string.size; i++){
-        ret[i] = string.data.array[i].data.c;
-    }
-    ret[string.size] = '\0';
-    return ret;
+bool is_list(value v)
+{
+    value_type t = type_of(v);
+    return t == array || t == numbers || t == view || t == bits || t == lazy;
 }
 
-#define max(x, y) x > y ? x : y
-#define min(x, y) x < y ? x : y
+bool is_constant_or_numbers(value v)
+{
+    return type_of(v) == constant || type_of(v) == numbers;
+}
 
-char* get_string_slice(value string, int start, int end)
+bool is_numeric(value v)
 {
-    assert(is_string(string));
-    assert(end >= start);
+    return is_constant_or_numbers(v) || type_of(v) == view;
+}
 
-    end = min(string.size, end);
+value new_constant(double);
+value new_character(char);
+value view_at(s24_vm*, value, int);
+value force(s24_vm*, value);
+value evaluate(s24_vm*, value);
+value retain(value);
+void release(s24_vm*, value);
+double lazy_at(value, int);
+
+// sempre uma referência nova: elementos de array ganham um retain, e as
+// linhas de uma view são um objeto novo que só existe pra quem pediu
+value array_at(s24_vm* vm, value array, int at)
+{
+    assert(is_array(array));
+    assert(at >= 0 && at < size_of(array));
+
+    if (type_of(array) == numbers)
+        return new_constant(as_numbers(array)[at]);
+    if (type_of(array) == string)
+        return new_character(as_bytes(array)[at]);
+    if (type_of(array) == view)
+        return view_at(vm, array, at);
+    if (type_of(array) == bits)
+        return new_constant(bit_at(array, at));
+    if (type_of(array) == lazy)
+        return new_constant(lazy_at(array, at));
+
+    return retain(as_array(array)[at]);
+}
 
-    int size = end - start;
+void* object_alloc(s24_vm*, size_t);
+void object_free(s24_vm*, void*);
 
-    char* ret = malloc(sizeof(char) * size + 1);
-    for (int i = 0; i < size; i++){
-        ret[i] = string.data.array[i + start].data.c;
+// região para temporários que não escapam do builtin que os criou. alocar é
+// só avançar um ponteiro, e release_region() devolve tudo de uma vez.
+void* region_alloc(s24_vm* vm, size_t size)
+{
+    size = (size + 15) & ~(size_t) 15;
+    if (vm->region == NULL || vm->region->used + size > vm->region->capacity)
+    {
+        size_t capacity = size > region_chunk_size ? size : region_chunk_size;
+        chunk* c = malloc(sizeof(chunk) + capacity);
+        if (c == NULL)
+        {
+            fprintf(stderr, "error: out of memory!\n");
+            exit(1);
+        }
+        c->prev = vm->region;
+        c->used = 0;
+        c->capacity = capacity;
+        vm->region = c;
     }
-    ret[size] = '\0';
-    return ret;
+    void* p = (char*) (vm->region + 1) + vm->region->used;
+    vm->region->used += size;
+    return p;
 }
 
-bool is_array(value v)
+region_mark mark_region(s24_vm* vm)
 {
-    return v.type == array || v.type == string;
+    return (region_mark) { vm->region, vm->region != NULL ? vm->region->used : 0 };
 }
 
-value array_at(value array, int at)
+void release_region(s24_vm* vm, region_mark m)
 {
-    assert(is_array(array));
-    assert(at >= 0 && at < array.size);
-
-    return array.data.array[at];
+    // mantém o primeiro chunk para não ficar alocando de novo a cada builtin
+    while (vm->region != m.c && vm->region->prev != NULL)
+    {
+        chunk* prev = vm->region->prev;
+        free(vm->region);
+        vm->region = prev;
+    }
+    if (vm->region != NULL)
+        vm->region->used = vm->region == m.c ? m.used : 0;
 }
 
 // gracias gpt
-int read_file_to_string(const char *filename, char** out)
+int read_file_to_string(s24_vm* vm, const char *filename, char** out)
 {
     FILE* file = fopen(filename, "r");
     if (file == NULL) 
     {
+        bail(vm);
         fprintf(stderr, "Failed to open file\n");
-        exit(1);
+        fail(vm);
     }
 
     // Seek to the end of the file to get the file size
@@ -133,7 +549,7 @@ int read_file_to_string(const char *filename, char** out)
     rewind(file);
 
     // Allocate memory for the file content
-    char* buffer = malloc(fileSize + 1);
+    char* buffer = object_alloc(vm, fileSize + 1);
     if (buffer == NULL) 
     {
         fprintf(stderr, "Failed to allocate memory\n");
@@ -145,10 +561,11 @@ int read_file_to_string(const char *filename, char** out)
     size_t bytesRead = fread(buffer, 1, fileSize, file);
     if (bytesRead != fileSize) 
     {
+        bail(vm);
         fprintf(stderr, "Failed to read file\n");
-        free(buffer);
+        object_free(vm, buffer);
         fclose(file);
-        exit(1);
+        fail(vm);
     }
 
     // Null-terminate the string
@@ -159,396 +576,1834 @@ int read_file_to_string(const char *filename, char** out)
     return fileSize;
 }
 
-int tally(value arr)
+int tally(s24_vm* vm, value arr)
 {
     if (is_array(arr))
     {
         int sum = 0;
-        for (int i = 0; i < arr.size; i++)
-            sum += tally(array_at(arr, i));
+        for (int i = 0; i < size_of(arr); i++)
+        {
+            value x = array_at(vm, arr, i);
+            sum += tally(vm, x);
+            release(vm, x);
+        }
         return sum;
     }
     return 1;
 }
 
-void _array_elements_type(value v, int* idx, value_type* types)
+void _array_elements_type(s24_vm* vm, value v, int* idx, value_type* types)
 {
     if (is_array(v))
     {
-        for (int i = 0; i < v.size; i++)
-            _array_elements_type(array_at(v, i), idx, types);
+        for (int i = 0; i < size_of(v); i++)
+        {
+            value x = array_at(vm, v, i);
+            _array_elements_type(vm, x, idx, types);
+            release(vm, x);
+        }
         return;
     }
-    types[*idx] = v.type;
+    types[*idx] = type_of(v);
     *idx += 1;
 }
 
-value_type array_elements_type(value arr)
+value_type array_elements_type(s24_vm* vm, value arr)
 {
     assert(is_array(arr));
 
-    int t = tally(arr);
-    value_type* types = malloc(sizeof(value_type) * t);
+    region_mark m = mark_region(vm);
+    int t = tally(vm, arr);
+    value_type* types = region_alloc(vm, sizeof(value_type) * t);
     int idx = 0;
-    _array_elements_type(arr, &idx, types);
+    _array_elements_type(vm, arr, &idx, types);
 
     value_type lead = types[0];
     for (int i = 1; i < t; i++) {
         if (lead != types[i]) {
-            free(types);
-            return -1;
+            lead = -1;
+            break;
         }
     }
-    free(types);
+    release_region(vm, m);
     return lead;
 }
 
 
-void pretty_value(value v, bool a)
+void pretty_value(s24_vm* vm, value v, bool a)
 {
-    switch (v.type) 
+    switch (type_of(v)) 
     {
         case character:
-            printf("'%c'", v.data.c);
+            fprintf(vm->out, "'%c'", as_char(v));
             break;
         case constant:
-            printf(
-                fmodl(v.data.constant, 1) == 0 ? "%-4.0lf" : "%-4.4lf",
-                v.data.constant
+            fprintf(vm->out, 
+                fmodl(as_constant(v), 1) == 0 ? "%-4.0lf" : "%-4.4lf",
+                as_constant(v)
             );
             break;
         case string:
-            {
-                char* s = get_string(v);
-                printf("\"%s\"", s);
-            }
+            fprintf(vm->out, "\"%.*s\"", size_of(v), as_bytes(v));
             break;
         case array:
-            if (v.size > 0 && array_at(v, 0).type == array) {
-                if (a) printf("\n");
-                for (int i = 0; i < v.size; i++)
+        case view:
+        {
+            value first = size_of(v) > 0 ? array_at(vm, v, 0) : new_null();
+            bool rows = is_list(first);
+            release(vm, first);
+            if (rows) {
+                if (a) fprintf(vm->out, "\n");
+                for (int i = 0; i < size_of(v); i++)
                 {
-                    value v2 = array_at(v, i);
-                    for (int j = 0; j < v2.size; j++)
+                    value v2 = array_at(vm, v, i);
+                    for (int j = 0; j < size_of(v2); j++)
                     {
-                        pretty_value(array_at(v2, j), a);
-                        printf(" ");
+                        value x = array_at(vm, v2, j);
+                        pretty_value(vm, x, a);
+                        release(vm, x);
+                        fprintf(vm->out, " ");
                     }
-                    if (i != v.size-1)
-                        printf("\n");
+                    release(vm, v2);
+                    if (i != size_of(v)-1)
+                        fprintf(vm->out, "\n");
                 }
                 return;
             }
-            printf("(( ");
+            fprintf(vm->out, "(( ");
+
+            for (int i = 0; i < size_of(v); i++)  {
+                value x = array_at(vm, v, i);
+                pretty_value(vm, x, false);
+                release(vm, x);
+                fprintf(vm->out, " ");
+            }
+
+            fprintf(vm->out, "))");
+            break;
+        }
+        case numbers:
+            fprintf(vm->out, "(( ");
+
+            for (int i = 0; i < size_of(v); i++)  {
+                pretty_value(vm, new_constant(as_numbers(v)[i]), false);
+                fprintf(vm->out, " ");
+            }
 
-            for (int i = 0; i < v.size; i++)  {
-                pretty_value(v.data.array[i], false);
-                printf(" ");
+            fprintf(vm->out, "))");
+            break;
+        case bits:
+            fprintf(vm->out, "(( ");
+
+            for (int i = 0; i < size_of(v); i++)  {
+                pretty_value(vm, new_constant(bit_at(v, i)), false);
+                fprintf(vm->out, " ");
             }
 
-            printf("))");
+            fprintf(vm->out, "))");
             break;
         case nest:
-            printf("[ ");
-            for (int i = 0; i < v.size; i++) 
-                printf("%s ", v.data.nest + (i*token_stride));
-            printf("]");
+            fprintf(vm->out, "[ ");
+            for (int i = 0; i < size_of(v); i++) 
+                fprintf(vm->out, "%s ", symbol_name(vm, as_nest(v)[i].token));
+            fprintf(vm->out, "]");
             break;
         default:
-            printf("?value %d?", v.type);
+            fprintf(vm->out, "?value %d?", type_of(v));
             break;
     }
 }
 
-void print_pretty_value(value v, bool display_type)
+void print_pretty_value(s24_vm* vm, value v, bool display_type)
 {
+    bool forced = type_of(v) == lazy;
+    if (forced)
+        v = force(vm, retain(v));
     if (display_type)
     {
-        if (v.type == array && v.size > 1)
+        if (is_list(v) && size_of(v) > 1)
         {
-            int et = array_elements_type(v);
+            int et = array_elements_type(vm, v);
             if (et < 0)
-                printf("( array ) ");
+                fprintf(vm->out, "( array ) ");
             else {
-                printf("( %s array ) ", type_string[et]);
+                fprintf(vm->out, "( %s array ) ", type_string[et]);
             }
         }
         else {
-            printf("( %s ) ", type_string[v.type]);
+            fprintf(vm->out, "( %s ) ", type_string[type_of(v)]);
         }
     }
-    pretty_value(v, display_type);
-    printf("\n");
+    pretty_value(vm, v, display_type);
+    fprintf(vm->out, "\n");
+    if (forced)
+        release(vm, v);
 }
 
-void print_vars()
+void print_vars(s24_vm* vm)
 {
-    for (int i = 0; i < var_count; i++) 
+    for (int i = 0; i < vm->symbol_count; i++) 
     {
+        if (!vm->symbols[i].defined)
+            continue;
 
         // char* value_string = value_repr(var_data[i]);
-        printf("\"%s\":\n", var_names[i]);
-        print_pretty_value(var_data[i], false);
-        printf("\n");
+        fprintf(vm->out, "\"%s\":\n", symbol_name(vm, i));
+        print_pretty_value(vm, vm->symbols[i].data, false);
+        fprintf(vm->out, "\n");
     }
 }
 
-void print_stack()
+void print_stack(s24_vm* vm)
 {
-    int limit = stack_size < stack_print_limit 
+    int limit = vm->stack_size < stack_print_limit 
         ?  0 
-        : stack_size - stack_print_limit;
+        : vm->stack_size - stack_print_limit;
 
-    printf("stack (%d-%d):\n\n", stack_size, stack_size-limit);
+    fprintf(vm->out, "stack (%d-%d):\n\n", vm->stack_size, vm->stack_size-limit);
 
-    for (int i = stack_size-1; i >= limit; i--) 
+    for (int i = vm->stack_size-1; i >= limit; i--) 
     {
 
-        value v = stack[i];
+        value v = vm->stack[i];
 
-        print_pretty_value(v, true);
+        print_pretty_value(vm, v, true);
         // printf("--\t--\t--\n");
     }
-    printf("end of stack\n");
-    printf("--\t--\t--\n");
+    fprintf(vm->out, "end of stack\n");
+    fprintf(vm->out, "--\t--\t--\n");
 }
 
-void push(value v)
+void push(s24_vm* vm, value v)
 {
-    if (stack_size >= max_stack) 
+    if (vm->stack_size >= max_stack) 
     {
+        bail(vm);
         fprintf(stderr, "error: max stack achieved (%d)!\n", max_stack);
-        print_stack();
-        exit(1);
+        print_stack(vm);
+        fail(vm);
     }
-    stack[stack_size++] = v;
+    vm->stack[vm->stack_size++] = v;
 }
 
-value pop()
+// as versões _lazy são para quem sabe lidar com uma conta adiada, as outras
+// já entregam o resultado
+value pop_lazy(s24_vm* vm)
 {
-    if (stack_size <= 0) 
+    if (vm->stack_size <= vm->stack_floor) 
     {
-        fprintf(stderr, "error: ran out of stack! (%d)\n", stack_size);
-        exit(1);
+        bail(vm);
+        fprintf(stderr, "error: ran out of stack! (%d)\n", vm->stack_size);
+        fail(vm);
     }
-    return stack[--stack_size];
+    return vm->stack[--vm->stack_size];
 }
 
-value peek()
+value peek_lazy(s24_vm* vm)
 {
-    if (stack_size <= 0) 
+    if (vm->stack_size <= vm->stack_floor) 
     {
-        fprintf(stderr, "error: ran out of stack! (%d)\n", stack_size);
-        exit(1);
+        bail(vm);
+        fprintf(stderr, "error: ran out of stack! (%d)\n", vm->stack_size);
+        fail(vm);
     }
-    return stack[stack_size-1];
+    return vm->stack[vm->stack_size-1];
 }
 
-int find_var(char* token)
+value pop(s24_vm* vm)
 {
-    for (int i = 0; i < var_count; i++)
-        if (strcmp(token, var_names[i]) == 0) 
-            return i;
-    return -1; // not found
+    return force(vm, pop_lazy(vm));
 }
 
-value new_character(char c)
+value peek(s24_vm* vm)
 {
-    return (value) 
-        {
-            .type = character,
-            .data.c = c,
-            .size = 0
-        };
+    peek_lazy(vm);
+    vm->stack[vm->stack_size-1] = force(vm, vm->stack[vm->stack_size-1]);
+    return vm->stack[vm->stack_size-1];
 }
 
-value new_constant(double c)
+unsigned int hash_string(char* s)
 {
-    return (value) 
-        {
-            .type = constant,
-            .data.constant = c,
-            .size = 0
-        };
+    // fnv-1a
+    unsigned int h = 2166136261u;
+    for (; *s != '\0'; s++)
+        h = (h ^ (unsigned char) *s) * 16777619u;
+    return h;
+}
+
+void grow_symbol_slots(s24_vm* vm)
+{
+    free(vm->symbol_slots);
+    vm->symbol_slots_size = vm->symbol_slots_size == 0 ? 256 : vm->symbol_slots_size * 2;
+    vm->symbol_slots = calloc(vm->symbol_slots_size, sizeof(int));
+
+    unsigned int mask = vm->symbol_slots_size - 1;
+    for (int id = 0; id < vm->symbol_count; id++)
+    {
+        unsigned int i = vm->symbols[id].hash & mask;
+        while (vm->symbol_slots[i] != 0)
+            i = (i + 1) & mask;
+        vm->symbol_slots[i] = id + 1;
+    }
+}
+
+int intern(s24_vm* vm, char* name)
+{
+    if (vm->symbol_count*2 >= vm->symbol_slots_size)
+        grow_symbol_slots(vm);
+
+    unsigned int hash = hash_string(name);
+    unsigned int mask = vm->symbol_slots_size - 1;
+    unsigned int i = hash & mask;
+
+    for (; vm->symbol_slots[i] != 0; i = (i + 1) & mask)
+    {
+        int id = vm->symbol_slots[i] - 1;
+        if (vm->symbols[id].hash == hash && strcmp(symbol_name(vm, id), name) == 0)
+            return id;
+    }
+
+    int len = strlen(name) + 1;
+    if (vm->symbol_names_size + len > vm->symbol_names_capacity)
+    {
+        while (vm->symbol_names_size + len > vm->symbol_names_capacity)
+            vm->symbol_names_capacity = vm->symbol_names_capacity == 0 ? 4096 : vm->symbol_names_capacity * 2;
+        vm->symbol_names = realloc(vm->symbol_names, vm->symbol_names_capacity);
+    }
+    memcpy(vm->symbol_names + vm->symbol_names_size, name, len);
+
+    if (vm->symbol_count >= vm->symbol_capacity)
+    {
+        vm->symbol_capacity = vm->symbol_capacity == 0 ? 128 : vm->symbol_capacity * 2;
+        vm->symbols = realloc(vm->symbols, sizeof(symbol) * vm->symbol_capacity);
+    }
+
+    int id = vm->symbol_count++;
+    vm->symbols[id] = (symbol) {
+        .name = vm->symbol_names_size,
+        .hash = hash,
+        .defined = false,
+    };
+    vm->symbol_names_size += len;
+    vm->symbol_slots[i] = id + 1;
+    return id;
 }
 
-value string_to_constant(value v)
+value string_to_constant(s24_vm* vm, value v)
 {
-    assert(v.type == string);
+    assert(type_of(v) == string);
     double number;
-    char* s = get_string(v);
-    if (sscanf(s, "%lf", &number) == 0)
+    if (sscanf(as_bytes(v), "%lf", &number) == 0)
     {
-        fprintf(stderr, "error: failure at converting string \"%s!\"\n", s);
-        exit(1);
+        bail(vm);
+        fprintf(stderr, "error: failure at converting string \"%s!\"\n", as_bytes(v));
+        fail(vm);
     }
-    free(s);
     return new_constant(number);
 }
 
 
 double get_constant(value c)
 {
-    assert(c.type == constant);
+    assert(type_of(c) == constant);
 
-    return c.data.constant;
+    return as_constant(c);
 }
 
-value new_nest()
+void link_object(s24_vm* vm, object* o)
 {
-    return (value) { 
-        .type = nest, 
-        .data.nest = NULL,
-        .size = 0,
-    };
+    o->prev = NULL;
+    o->next = vm->objects;
+    if (vm->objects != NULL)
+        vm->objects->prev = o;
+    vm->objects = o;
 }
 
-value new_array(int size)
+void unlink_object(s24_vm* vm, object* o)
 {
-    value new = (value) { 
-        .type = array, 
-        .data.array = malloc(sizeof(value) * size),
-        .size = size,
-    };
-    return new;
+    if (o->prev != NULL)
+        o->prev->next = o->next;
+    else
+        vm->objects = o->next;
+    if (o->next != NULL)
+        o->next->prev = o->prev;
 }
 
-value new_string(int size)
+void count_heap(s24_vm* vm, ssize_t delta)
 {
-    return (value) { 
-        .type = string, 
-        .data.array = malloc(sizeof(value) * size),
-        .size = size,
-    };
+    vm->gc.heap += delta;
+    if (vm->gc.heap > vm->gc.peak)
+        vm->gc.peak = vm->gc.heap;
 }
 
-value from_string(char* s)
+void* object_alloc(s24_vm* vm, size_t size)
 {
-    int len = strlen(s);
-    value r = new_string(len);
-
-    for (int i = 0; i < r.size; i++)
+    object* o = malloc(sizeof(object) + size);
+    if (o == NULL)
     {
-        r.data.array[i] = new_character(s[i]);
+        fprintf(stderr, "error: out of memory!\n");
+        exit(1);
     }
-    return r;
+    o->refs = 1;
+    o->marked = false;
+    o->shared = false;
+    o->size = o->capacity = size;
+    link_object(vm, o);
+    count_heap(vm, size);
+    return o + 1;
 }
 
-
-void array_append(value* array, value x) 
+// só vai ao realloc quando passa da capacidade, e aí pelo menos dobra
+void* object_resize(s24_vm* vm, void* payload, size_t size)
 {
-    array->data.array = realloc(array->data.array , sizeof(value) * ++array->size);
-    array->data.array[array->size-1] = x;
+    object* o = header(payload);
+    if (size > o->capacity)
+    {
+        size_t capacity = o->capacity * 2 > size ? o->capacity * 2 : size;
+        size_t old_capacity = o->capacity;
+        unlink_object(vm, o);
+
+        o = realloc(o, sizeof(object) + capacity);
+        if (o == NULL)
+        {
+            fprintf(stderr, "error: out of memory!\n");
+            exit(1);
+        }
+        o->capacity = capacity;
+        link_object(vm, o);
+        count_heap(vm, capacity - old_capacity);
+    }
+    o->size = size;
+    return o + 1;
 }
 
-void nest_append(value* n, char* tok) 
+void object_free(s24_vm* vm, void* payload)
 {
-    assert(n->type == nest);
-    n->data.nest = realloc(n->data.nest , max_token_len * ++n->size);
-    strcpy(n->data.nest + (n->size-1)*token_stride, tok);
+    object* o = header(payload);
+    unlink_object(vm, o);
+    count_heap(vm, -o->capacity);
+    free(o);
 }
 
-value wrap_array(value v) 
+bool is_heap(value v)
 {
-    value a = new_array(1);
-    a.data.array[0] = v;
-    return a;
+    value_type t = type_of(v);
+    return t == array || t == numbers || t == string || t == view || t == lazy 
+        || t == bits;
 }
 
+// objetos compartilhados entre workers contam atomicamente. o dono segura
+// uma referência enquanto eles rodam, então ali a conta nunca chega a zero.
+value retain(value v)
+{
+    if (!is_heap(v))
+        return v;
+    object* o = header(as_payload(v));
+    if (o->shared)
+        __atomic_add_fetch(&o->refs, 1, __ATOMIC_RELAXED);
+    else
+        o->refs++;
+    return v;
+}
 
-value copy(value v) 
+void release(s24_vm* vm, value v)
 {
-    if (v.type == array || v.type == string) 
-    {
+    if (!is_heap(v))
+        return;
+    object* o = header(as_payload(v));
+    if ((o->shared ? __atomic_sub_fetch(&o->refs, 1, __ATOMIC_ACQ_REL) : --o->refs) > 0)
+        return;
 
-        value new = new_array(v.size);
-        new.type = v.type;
+    if (type_of(v) == array)
+        for (int i = 0; i < size_of(v); i++)
+            release(vm, as_array(v)[i]);
+    if (type_of(v) == view)
+        release(vm, as_layout(v)->base);
+    if (type_of(v) == lazy)
+    {
+        release(vm, as_deferred(v)->x);
+        release(vm, as_deferred(v)->y);
+        release(vm, as_deferred(v)->result);
+    }
 
-        for (int i = 0; i < new.size; i++) 
-        {
-            new.data.array[i] = copy(array_at(v, i));
-        }
+    object_free(vm, as_payload(v));
+}
 
-        return new;
+void keep(s24_vm* vm, value* values, int count)
+{
+    if (vm->root_count >= max_roots)
+    {
+        bail(vm);
+        fprintf(stderr, "error: max roots achieved (%d)!\n", max_roots);
+        fail(vm);
     }
+    vm->roots[vm->root_count++] = (root) { values, count };
+}
 
-    return v;
+void drop(s24_vm* vm, int count)
+{
+    vm->root_count -= count;
 }
 
-void free_value(value v) 
+void mark(value v)
 {
-    switch (v.type) 
+    if (!is_heap(v) || header(as_payload(v))->marked)
+        return;
+
+    header(as_payload(v))->marked = true;
+    if (type_of(v) == array)
+        for (int i = 0; i < size_of(v); i++)
+            mark(as_array(v)[i]);
+    if (type_of(v) == view)
+        mark(as_layout(v)->base);
+    if (type_of(v) == lazy)
     {
-        case array:
-            for (int i = 0; i < v.size; i++) 
-            {
-                free_value(v.data.array[i]);
-            }
-            free(v.data.array);
-            break;
-        case nest:
-            free(v.data.nest);
-            break;
-        default:
-            break;
+        mark(as_deferred(v)->x);
+        mark(as_deferred(v)->y);
+        mark(as_deferred(v)->result);
     }
 }
 
+// o contador libera quase tudo sozinho. o coletor pega o que escapou dele,
+// e só roda entre instruções, quando todo valor vivo está em alguma raiz.
+void collect(s24_vm* vm)
+{
+    clock_t start = clock();
+
+    for (int i = 0; i < vm->stack_size; i++)
+        mark(vm->stack[i]);
+    for (int i = 0; i < vm->symbol_count; i++)
+        if (vm->symbols[i].defined)
+            mark(vm->symbols[i].data);
+    for (int i = 0; i < vm->constant_count; i++)
+        mark(vm->constants[i]);
+    mark(vm->broadcast);
+    for (int i = 0; i < vm->root_count; i++)
+        for (int j = 0; j < vm->roots[i].count; j++)
+            mark(vm->roots[i].values[j]);
+
+    // filhos vivos de um objeto morto ficam com uma referência a mais, e
+    // voltam para o coletor quando também ficarem inalcançáveis
+    object* o = vm->objects;
+    while (o != NULL)
+    {
+        object* next = o->next;
+        if (o->marked)
+            o->marked = false;
+        else {
+            vm->gc.freed_objects++;
+            vm->gc.freed_bytes += o->capacity;
+            object_free(vm, o + 1);
+        }
+        o = next;
+    }
 
+    vm->gc.collections++;
+    vm->gc.threshold = vm->gc.heap * 2 > gc_initial_threshold ? vm->gc.heap * 2 : gc_initial_threshold;
+    vm->gc.time += clock() - start;
+}
 
-// --------------------------- //
-// ----     built-ins    ----- //
-// --------------------------- //
-
-// binary built-ins
+void print_gc_stats(s24_vm* vm)
+{
+    fprintf(stderr,
+        "gc: %d collections, %zu objects (%zu bytes) freed, "
+        "%zu bytes live, %zu bytes peak, %.3fs\n",
+        vm->gc.collections, vm->gc.freed_objects, vm->gc.freed_bytes,
+        vm->gc.heap, vm->gc.peak, (double) vm->gc.time / CLOCKS_PER_SEC);
+}
 
-value coerce_to_array(value v) 
+value new_array(s24_vm* vm, int size)
 {
-    if (v.type == array)
-        return v;
+    return box_object(array, object_alloc(vm, sizeof(value) * size), size);
+}
 
-    value r = new_array(1);
-    r.data.array[0] = v;
-    return r;
+value new_numbers(s24_vm* vm, int size)
+{
+    return box_object(numbers, object_alloc(vm, sizeof(double) * size), size);
 }
 
-value binary_op(value val1, value val2, value (*func)(value,value)) 
+value new_bits(s24_vm* vm, int size)
 {
-    val1 = coerce_to_array(val1);
-    val2 = coerce_to_array(val2);
+    uint64_t* payload = object_alloc(vm, sizeof(uint64_t) * (1 + word_count(size)));
+    memset(payload, 0, sizeof(uint64_t) * (1 + word_count(size)));
+    payload[0] = size;
+    return box_object(bits, payload, size);
+}
 
-    bool map_val1 = val1.size > 1, map_val2 = val2.size > 1; 
+// zera o que sobra da última palavra depois de operações palavra a palavra
+value trim_bits(value v)
+{
+    if (size_of(v) % 64 != 0)
+        as_words(v)[size_of(v) >> 6] &= ((uint64_t) 1 << (size_of(v) % 64)) - 1;
+    return v;
+}
 
-    if (map_val1 && map_val2 && val1.size != val2.size) 
+// size bits de src a partir do bit from, palavra a palavra. dst pode ser o
+// próprio src quando from < 64.
+void copy_bits(uint64_t* dst, uint64_t* src, int from, int size)
+{
+    int shift = from & 63;
+    src += from >> 6;
+    for (int i = 0; i < word_count(size); i++)
     {
-        fprintf(
-            stderr,
-            "error: size mismatch (%d x %d)!\n",
-            val1.size, val2.size);
-        // exit() é o melhor free() de todos
-        exit(1);
+        dst[i] = src[i] >> shift;
+        if (shift != 0 && (i + 1) * 64 - shift < size)
+            dst[i] |= src[i + 1] << (64 - shift);
     }
+}
 
-    int size = max(val1.size, val2.size);
-    value arr = new_array(size);
-    for (int i = 0; i < size; i++) 
+uint64_t reverse_word(uint64_t w)
+{
+    w = (w >> 1 & 0x5555555555555555ull) | (w & 0x5555555555555555ull) << 1;
+    w = (w >> 2 & 0x3333333333333333ull) | (w & 0x3333333333333333ull) << 2;
+    w = (w >> 4 & 0x0f0f0f0f0f0f0f0full) | (w & 0x0f0f0f0f0f0f0f0full) << 4;
+    return __builtin_bswap64(w);
+}
+
+// até 64 doubles numa palavra, diferente de zero vira 1
+uint64_t pack_word(double* x, int n)
+{
+    uint64_t w = 0;
+    for (int i = 0; i < n; i++)
+        w |= (uint64_t) (x[i] != 0) << i;
+    return w;
+}
+
+void unpack_bits(value v, double* out)
+{
+    for (int i = 0; i < size_of(v); i++)
+        out[i] = bit_at(v, i);
+}
+
+// fica com a referência de v
+value numbers_to_bits(s24_vm* vm, value v)
+{
+    value r = new_bits(vm, size_of(v));
+    for (int i = 0; i < size_of(v); i += 64)
+        as_words(r)[i >> 6] = pack_word(as_numbers(v) + i, 
+                size_of(v) - i < 64 ? size_of(v) - i : 64);
+    release(vm, v);
+    return r;
+}
+
+// bits viram numbers para quem só sabe lidar com doubles. sempre devolve
+// uma referência nova.
+value unpack(s24_vm* vm, value v)
+{
+    if (type_of(v) != bits)
+        return retain(v);
+
+    value r = new_numbers(vm, size_of(v));
+    unpack_bits(v, as_numbers(r));
+    return r;
+}
+
+// arrays só de constantes viram um buffer de doubles
+value pack(s24_vm* vm, value arr)
+{
+    if (type_of(arr) != array || size_of(arr) <= 0)
+        return arr;
+
+    for (int i = 0; i < size_of(arr); i++)
+        if (type_of(as_array(arr)[i]) != constant)
+            return arr;
+
+    value packed = new_numbers(vm, size_of(arr));
+    for (int i = 0; i < size_of(arr); i++)
+        as_numbers(packed)[i] = as_constant(as_array(arr)[i]);
+
+    release(vm, arr);
+    return packed;
+}
+
+value new_string(s24_vm* vm, int size)
+{
+    value s = box_object(string, object_alloc(vm, size + 1), size);
+    as_bytes(s)[size] = '\0';
+    return s;
+}
+
+value string_from_bytes(s24_vm* vm, char* bytes, int size)
+{
+    value r = new_string(vm, size);
+    memcpy(as_bytes(r), bytes, size);
+    return r;
+}
+
+value from_string(s24_vm* vm, char* s)
+{
+    return string_from_bytes(vm, s, strlen(s));
+}
+
+value new_view(s24_vm* vm, layout* l)
+{
+    layout* payload = object_alloc(vm, sizeof(layout));
+    *payload = *l;
+    retain(payload->base);
+    return box_object(view, payload, l->shape[0]);
+}
+
+// numbers e constantes também cabem num layout, com rank 1 e 0
+layout describe(value v)
+{
+    if (type_of(v) == view)
+        return *as_layout(v);
+
+    layout l = { .base = v, .rank = 0 };
+    if (type_of(v) == numbers)
     {
-        arr.data.array[i] = func(
-            val1.data.array[map_val1 ? i : 0],
-            val2.data.array[map_val2 ? i : 0]
-        );
+        l.data = as_numbers(v);
+        l.rank = 1;
+        l.shape[0] = size_of(v);
+        l.stride[0] = 1;
     }
+    return l;
+}
+
+int layout_count(layout* l)
+{
+    int count = 1;
+    for (int i = 0; i < l->rank; i++)
+        count *= l->shape[i];
+    return count;
+}
+
+bool same_shape(layout* a, layout* b)
+{
+    if (a->rank != b->rank)
+        return false;
+    for (int i = 0; i < a->rank; i++)
+        if (a->shape[i] != b->shape[i])
+            return false;
+    return true;
+}
+
+double* flatten(double* data, int rank, int* shape, int* stride, double* out)
+{
+    if (rank == 1)
+    {
+        for (int i = 0; i < shape[0]; i++)
+            *out++ = data[i * stride[0]];
+        return out;
+    }
+    for (int i = 0; i < shape[0]; i++)
+        out = flatten(data + i * stride[0], rank - 1, shape + 1, stride + 1, out);
+    return out;
+}
+
+// buffer contíguo novo com esse shape, já como numbers ou view
+value new_dense(s24_vm* vm, int rank, int* shape, double** data)
+{
+    layout l = { .rank = rank };
+    memcpy(l.shape, shape, sizeof(int) * rank);
+
+    int count = 1;
+    for (int i = rank - 1; i >= 0; i--)
+    {
+        l.stride[i] = count;
+        count *= shape[i];
+    }
+
+    l.base = new_numbers(vm, count);
+    l.data = as_numbers(l.base);
+    *data = l.data;
+    if (rank == 1)
+        return l.base;
+
+    value v = new_view(vm, &l);
+    release(vm, l.base);
+    return v;
+}
+
+// cópia contígua, os dados deixam de ser compartilhados
+value materialize(s24_vm* vm, value v)
+{
+    layout l = describe(v);
+    double* out;
+    value r = new_dense(vm, l.rank, l.shape, &out);
+    flatten(l.data, l.rank, l.shape, l.stride, out);
+    return r;
+}
+
+// os doubles de uma lista de rank 1, em sequência. views com passo
+// diferente de 1 e bits são copiados para a região.
+double* numbers_of(s24_vm* vm, value arr, int* size)
+{
+    if (type_of(arr) == bits)
+    {
+        *size = size_of(arr);
+        double* out = region_alloc(vm, sizeof(double) * *size);
+        unpack_bits(arr, out);
+        return out;
+    }
+    if (type_of(arr) != numbers && type_of(arr) != view)
+        return NULL;
+
+    layout l = describe(arr);
+    if (l.rank != 1)
+        return NULL;
+
+    *size = l.shape[0];
+    if (l.stride[0] == 1)
+        return l.data;
+
+    double* out = region_alloc(vm, sizeof(double) * *size);
+    flatten(l.data, l.rank, l.shape, l.stride, out);
+    return out;
+}
+
+// linhas novas nascem sem dono: quem guarda uma dá retain, e as que
+// ninguém guardou o coletor recolhe
+value view_at(s24_vm* vm, value v, int at)
+{
+    layout* l = as_layout(v);
+    double* p = l->data + at * l->stride[0];
+    if (l->rank == 1)
+        return new_constant(*p);
+
+    layout row = { .base = l->base, .data = p, .rank = l->rank - 1 };
+    memcpy(row.shape, l->shape + 1, sizeof(int) * row.rank);
+    memcpy(row.stride, l->stride + 1, sizeof(int) * row.rank);
+
+    return new_view(vm, &row);
+}
+
+// linhas de bits entram como se fossem numbers
+layout describe_row(value v)
+{
+    if (type_of(v) != bits)
+        return describe(v);
+    return (layout) { .rank = 1, .shape = { size_of(v) }, .stride = { 1 } };
+}
+
+bool is_row(value v)
+{
+    return type_of(v) == numbers || type_of(v) == view || type_of(v) == bits;
+}
+
+// linhas numéricas do mesmo shape viram uma matriz contígua com um rank a
+// mais. devolve null quando não dá.
+value stack_rows(s24_vm* vm, value* rows, int count)
+{
+    if (count < 1 || !is_row(rows[0]))
+        return new_null();
+
+    layout first = describe_row(rows[0]);
+    if (first.rank >= max_rank || layout_count(&first) == 0)
+        return new_null();
+
+    for (int i = 1; i < count; i++)
+    {
+        if (!is_row(rows[i]))
+            return new_null();
+        layout row = describe_row(rows[i]);
+        if (!same_shape(&first, &row))
+            return new_null();
+    }
+
+    int shape[max_rank] = { count };
+    memcpy(shape + 1, first.shape, sizeof(int) * first.rank);
+
+    double* out;
+    value matrix = new_dense(vm, first.rank + 1, shape, &out);
+    for (int i = 0; i < count; i++)
+    {
+        if (type_of(rows[i]) == bits)
+        {
+            unpack_bits(rows[i], out);
+            out += size_of(rows[i]);
+            continue;
+        }
+        layout row = describe(rows[i]);
+        out = flatten(row.data, row.rank, row.shape, row.stride, out);
+    }
+    return matrix;
+}
+
+bool is_null(value v)
+{
+    return type_of(v) == value_null;
+}
+
+// aceita também arrays de caracteres. sempre devolve uma referência nova.
+value to_string(s24_vm* vm, value v)
+{
+    if (is_string(v))
+        return retain(v);
+
+    if (!is_array(v))
+    {
+        bail(vm);
+        fprintf(stderr, "error: expected a string!\n");
+        fail(vm);
+    }
+
+    value r = new_string(vm, size_of(v));
+    for (int i = 0; i < size_of(v); i++)
+        as_bytes(r)[i] = as_char(array_at(vm, v, i));
+    return r;
+}
+
+// cópia rasa, os elementos passam a ser compartilhados
+value copy(s24_vm* vm, value v) 
+{
+    if (type_of(v) == view)
+        return materialize(vm, v);
+
+    if (type_of(v) == numbers)
+    {
+        value new = new_numbers(vm, size_of(v));
+        memcpy(as_numbers(new), as_numbers(v), sizeof(double) * size_of(v));
+        return new;
+    }
+
+    if (type_of(v) == string)
+        return string_from_bytes(vm, as_bytes(v), size_of(v));
+
+    if (type_of(v) == bits)
+    {
+        value new = new_bits(vm, size_of(v));
+        memcpy(as_words(new), as_words(v), sizeof(uint64_t) * word_count(size_of(v)));
+        return new;
+    }
+
+    if (type_of(v) == array) 
+    {
+
+        value new = new_array(vm, size_of(v));
+        for (int i = 0; i < size_of(new); i++) 
+        {
+            as_array(new)[i] = array_at(vm, v, i);
+        }
+
+        return new;
+    }
+
+    return v;
+}
+
+void make_unique(s24_vm* vm, value* v)
+{
+    if (!is_heap(*v) || header(as_payload(*v))->refs == 1)
+        return;
+
+    value unique = copy(vm, *v);
+    release(vm, *v);
+    *v = unique;
+}
+
+// array vazio com espaço para capacity elementos, para quem vai juntar
+// com array_append e já sabe (ou estima) quantos
+value array_builder(s24_vm* vm, int capacity)
+{
+    value* items = object_alloc(vm, sizeof(value) * capacity);
+    header(items)->size = 0;
+    return box_object(array, items, 0);
+}
+
+void array_append(s24_vm* vm, value* array, value x) 
+{
+    make_unique(vm, array);
+    int size = size_of(*array) + 1;
+    *array = box_object(type_of(*array), object_resize(vm, as_array(*array), sizeof(value) * size), size);
+    as_array(*array)[size - 1] = x;
+}
+
+value wrap_array(s24_vm* vm, value v) 
+{
+    value a = new_array(vm, 1);
+    as_array(a)[0] = v;
+    return a;
+}
+
+
+
+// --------------------------- //
+// ----     built-ins    ----- //
+// --------------------------- //
+
+// binary built-ins
+
+// escalares (e listas de um elemento) valem o mesmo para qualquer i, sem
+// precisar embrulhar num array. como array_at, é uma referência nova.
+value operand_at(s24_vm* vm, value v, int i)
+{
+    if (!is_list(v))
+        return retain(v);
+    return array_at(vm, v, size_of(v) > 1 ? i : 0);
+}
+
+// func só empresta os operandos, o elemento i é solto logo depois
+value apply_at(s24_vm* vm, value (*func)(s24_vm*, value), value v, int i)
+{
+    value x = operand_at(vm, v, i);
+    keep(vm, &x, 1);
+    value r = func(vm, x);
+    drop(vm, 1);
+    release(vm, x);
+    return r;
+}
+
+value apply2_at(s24_vm* vm, value (*func)(s24_vm*, value, value), value a, value b, int i)
+{
+    value x[2] = { operand_at(vm, a, i), operand_at(vm, b, i) };
+    keep(vm, x, 2);
+    value r = func(vm, x[0], x[1]);
+    drop(vm, 1);
+    release(vm, x[0]);
+    release(vm, x[1]);
+    return r;
+}
+
+int operand_size(value v)
+{
+    return is_list(v) ? size_of(v) : 1;
+}
+
+// resultados montados na região passam para o heap, empacotados se der
+value gather(s24_vm* vm, value* items, int size)
+{
     if (size == 1)
-        return array_at(arr, 0);
+        return items[0];
+
+    bool all_constant = true;
+    for (int i = 0; i < size && all_constant; i++)
+        all_constant = type_of(items[i]) == constant;
+
+    if (all_constant && size > 0)
+    {
+        value packed = new_numbers(vm, size);
+        for (int i = 0; i < size; i++)
+            as_numbers(packed)[i] = as_constant(items[i]);
+        return packed;
+    }
+
+    value matrix = stack_rows(vm, items, size);
+    if (!is_null(matrix))
+    {
+        for (int i = 0; i < size; i++)
+            release(vm, items[i]);
+        return matrix;
+    }
+
+    value arr = new_array(vm, size);
+    memcpy(as_array(arr), items, sizeof(value) * size);
+    return arr;
+}
+
+// laços inteiros para as operações elemento a elemento mais comuns, sem
+// chamar numeric() a cada elemento. passo 1 anda no buffer e passo 0 repete
+// o mesmo escalar. a versão é escolhida uma vez, conforme a cpu.
+typedef void (*kernel)(double* out, double* x, double* y, int n, int sx, int sy);
+
+#define scalar_kernel(name, expr) \
+void name##_scalar(double* out, double* x, double* y, int n, int sx, int sy) { \
+    for (int i = 0; i < n; i++) { \
+        double a = x[i * sx], b = y[i * sy]; \
+        out[i] = expr; \
+    } \
+}
+
+#if defined(__x86_64__)
+
+#define simd_kernels(name, expr, avx, sse) \
+scalar_kernel(name, expr) \
+__attribute__((target("avx2"))) \
+void name##_avx2(double* out, double* x, double* y, int n, int sx, int sy) { \
+    if (n <= 0) \
+        return; \
+    __m256d a = _mm256_set1_pd(*x), b = _mm256_set1_pd(*y); \
+    int i = 0; \
+    for (; i + 4 <= n; i += 4) { \
+        if (sx) a = _mm256_loadu_pd(x + i); \
+        if (sy) b = _mm256_loadu_pd(y + i); \
+        _mm256_storeu_pd(out + i, avx); \
+    } \
+    name##_scalar(out + i, x + i * sx, y + i * sy, n - i, sx, sy); \
+} \
+void name##_sse2(double* out, double* x, double* y, int n, int sx, int sy) { \
+    if (n <= 0) \
+        return; \
+    __m128d a = _mm_set1_pd(*x), b = _mm_set1_pd(*y); \
+    int i = 0; \
+    for (; i + 2 <= n; i += 2) { \
+        if (sx) a = _mm_loadu_pd(x + i); \
+        if (sy) b = _mm_loadu_pd(y + i); \
+        _mm_storeu_pd(out + i, sse); \
+    } \
+    name##_scalar(out + i, x + i * sx, y + i * sy, n - i, sx, sy); \
+}
+
+#else
+
+#define simd_kernels(name, expr, avx, sse) scalar_kernel(name, expr)
+
+#endif
+
+// comparações viram máscaras, o and com 1.0 as transforma em 0 ou 1. NaN
+// nunca é igual a nada e é diferente de zero, como em C.
+simd_kernels(add, a + b, 
+        _mm256_add_pd(a, b), 
+        _mm_add_pd(a, b))
+simd_kernels(sub, a - b, 
+        _mm256_sub_pd(a, b), 
+        _mm_sub_pd(a, b))
+simd_kernels(mul, a * b, 
+        _mm256_mul_pd(a, b), 
+        _mm_mul_pd(a, b))
+simd_kernels(quo, a / b, 
+        _mm256_div_pd(a, b), 
+        _mm_div_pd(a, b))
+simd_kernels(eq, a == b, 
+        _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_EQ_OQ), _mm256_set1_pd(1)), 
+        _mm_and_pd(_mm_cmpeq_pd(a, b), _mm_set1_pd(1)))
+simd_kernels(lor, a || b, 
+        _mm256_and_pd(_mm256_or_pd(
+            _mm256_cmp_pd(a, _mm256_setzero_pd(), _CMP_NEQ_UQ), 
+            _mm256_cmp_pd(b, _mm256_setzero_pd(), _CMP_NEQ_UQ)), _mm256_set1_pd(1)), 
+        _mm_and_pd(_mm_or_pd(
+            _mm_cmpneq_pd(a, _mm_setzero_pd()), 
+            _mm_cmpneq_pd(b, _mm_setzero_pd())), _mm_set1_pd(1)))
+simd_kernels(land, a && b, 
+        _mm256_and_pd(_mm256_and_pd(
+            _mm256_cmp_pd(a, _mm256_setzero_pd(), _CMP_NEQ_UQ), 
+            _mm256_cmp_pd(b, _mm256_setzero_pd(), _CMP_NEQ_UQ)), _mm256_set1_pd(1)), 
+        _mm_and_pd(_mm_and_pd(
+            _mm_cmpneq_pd(a, _mm_setzero_pd()), 
+            _mm_cmpneq_pd(b, _mm_setzero_pd())), _mm_set1_pd(1)))
+simd_kernels(least, b < a ? b : a, 
+        _mm256_min_pd(b, a), 
+        _mm_min_pd(b, a))
+simd_kernels(most, b > a ? b : a, 
+        _mm256_max_pd(b, a), 
+        _mm_max_pd(b, a))
+
+struct {
+    kernel sum, sub, mul, div, equal, or, and, min, max;
+} kernels;
+
+// escolhida uma vez antes do main, depois as vms só leem
+__attribute__((constructor)) void select_kernels()
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        kernels.sum = add_avx2, kernels.sub = sub_avx2;
+        kernels.mul = mul_avx2, kernels.div = quo_avx2;
+        kernels.equal = eq_avx2, kernels.or = lor_avx2;
+        kernels.and = land_avx2;
+        kernels.min = least_avx2, kernels.max = most_avx2;
+        return;
+    }
+    kernels.sum = add_sse2, kernels.sub = sub_sse2;
+    kernels.mul = mul_sse2, kernels.div = quo_sse2;
+    kernels.equal = eq_sse2, kernels.or = lor_sse2;
+    kernels.and = land_sse2;
+    kernels.min = least_sse2, kernels.max = most_sse2;
+#else
+    kernels.sum = add_scalar, kernels.sub = sub_scalar;
+    kernels.mul = mul_scalar, kernels.div = quo_scalar;
+    kernels.equal = eq_scalar, kernels.or = lor_scalar;
+    kernels.and = land_scalar;
+    kernels.min = least_scalar, kernels.max = most_scalar;
+#endif
+}
+
+double __sum_numeric(double, double);
+double __sub_numeric(double, double);
+double __mul_numeric(double, double);
+double __div_numeric(double, double);
+double __equal_numeric(double, double);
+double __or_numeric(double, double);
+double __and_numeric(double, double);
+double __min_numeric(double, double);
+double __max_numeric(double, double);
+
+kernel find_kernel(double (*numeric)(double,double))
+{
+    if (numeric == __sum_numeric)   return kernels.sum;
+    if (numeric == __sub_numeric)   return kernels.sub;
+    if (numeric == __mul_numeric)   return kernels.mul;
+    if (numeric == __div_numeric)   return kernels.div;
+    if (numeric == __equal_numeric) return kernels.equal;
+    if (numeric == __or_numeric)    return kernels.or;
+    if (numeric == __and_numeric)   return kernels.and;
+    if (numeric == __min_numeric)   return kernels.min;
+    if (numeric == __max_numeric)   return kernels.max;
+    return NULL;
+}
+
+// mesma ideia para as operações de um argumento. aqui os laços usam os
+// vetores genéricos do gcc/clang, de dois doubles: no x86 viram sse2 e nos
+// outros alvos (wasm) o compilador se vira, sem precisar de outra versão.
+typedef double v2d __attribute__((vector_size(16)));
+typedef double v2d_unaligned __attribute__((vector_size(16), aligned(8)));
+typedef long long v2l __attribute__((vector_size(16)));
+typedef float v2f __attribute__((vector_size(8)));
+
+typedef void (*unary_kernel)(double* out, double* x, int n);
+
+#define vector_kernel(name) \
+void name##_kernel(double* out, double* x, int n) { \
+    int i = 0; \
+    for (; i + 2 <= n; i += 2) \
+        *(v2d_unaligned*) (out + i) = v_##name(*(v2d_unaligned*) (x + i)); \
+    if (i < n) \
+        out[i] = v_##name((v2d) { x[i], x[i] })[0]; \
+}
+
+// somar e subtrair 1.5 * 2^52 arredonda para o inteiro mais próximo (par
+// no empate), e os bits baixos do resultado já são o inteiro
+#define magic_round 0x1.8p52
+
+#define splat(x) ((v2d) { (x), (x) })
+
+v2d blend(v2l mask, v2d a, v2d b)
+{
+    return (v2d) (((v2l) a & mask) | ((v2l) b & ~mask));
+}
+
+v2d v_abs(v2d x)
+{
+    return (v2d) ((v2l) x & 0x7fffffffffffffffll);
+}
+
+v2d v_not(v2d x)
+{
+    return (v2d) ((x == 0.0) & (v2l) splat(1));
+}
+
+v2d v_gt0(v2d x)
+{
+    return (v2d) ((x > 0.0) & (v2l) splat(1));
+}
+
+v2d v_lt0(v2d x)
+{
+    return (v2d) ((x < 0.0) & (v2l) splat(1));
+}
+
+// como roundf: passa por float e o empate vai para longe do zero
+v2d v_round(v2d x)
+{
+    v2d f = __builtin_convertvector(__builtin_convertvector(x, v2f), v2d);
+    v2d n = (f + magic_round) - magic_round;
+    v2d tie = f + blend(f < 0.0, splat(-0.5), splat(0.5));
+    n = blend(v_abs(f - n) == 0.5, tie, n);
+    return blend(v_abs(f) < 0x1p51, n, f);
+}
+
+v2d v_sqrt(v2d x)
+{
+#if defined(__x86_64__)
+    return (v2d) _mm_sqrt_pd((__m128d) x);
+#else
+    return (v2d) { sqrt(x[0]), sqrt(x[1]) };
+#endif
+}
+
+// 2^k, k em [-1022, 1023]
+v2d pow2(v2l k)
+{
+    return (v2d) ((k + 1023) << 52);
+}
+
+// x = k ln2 + r com |r| <= ln2/2, e^r pela série até r^13, que erra
+// menos que 1e-17 nesse intervalo. erro medido contra a libm: <= 1 ulp.
+v2d v_exp(v2d x)
+{
+    x = blend(x > 710.0, splat(710), x);
+    x = blend(x < -746.0, splat(-746), x);
+
+    v2d t = x * 0x1.71547652b82fep0 + magic_round;
+    v2d k = t - magic_round;
+    v2l ki = (v2l) t - (v2l) splat(magic_round);
+
+    v2d r = x - k * 0x1.62e42fee00000p-1;
+    r = r - k * 0x1.a39ef35793c76p-33;
+
+    v2d p = splat(1.0 / 6227020800);
+    p = p * r + 1.0 / 479001600;
+    p = p * r + 1.0 / 39916800;
+    p = p * r + 1.0 / 3628800;
+    p = p * r + 1.0 / 362880;
+    p = p * r + 1.0 / 40320;
+    p = p * r + 1.0 / 5040;
+    p = p * r + 1.0 / 720;
+    p = p * r + 1.0 / 120;
+    p = p * r + 1.0 / 24;
+    p = p * r + 1.0 / 6;
+    p = p * r + 0.5;
+    p = p * r + 1.0;
+    p = p * r + 1.0;
+
+    // em duas metades para alcançar os subnormais e o infinito
+    v2l k1 = ki >> 1;
+    return p * pow2(k1) * pow2(ki - k1);
+}
+
+// x = 2^e m com m em [sqrt(2)/2, sqrt(2)], log m = 2 atanh(s), s = (m-1)/(m+1),
+// pela série ímpar até s^21, |s| <= 0.172. erro medido: <= 2 ulp.
+v2d v_log(v2d x)
+{
+    v2l tiny = x < 0x1p-1022;
+    v2l bits = (v2l) blend(tiny, x * 0x1p52, x);
+    v2l e = ((bits >> 52) & 0x7ff) - 1023 - (tiny & 52);
+    v2d m = (v2d) ((bits & 0x000fffffffffffffll) | 0x3ff0000000000000ll);
+
+    v2l big = m > 0x1.6a09e667f3bcdp0;
+    m = blend(big, m * 0.5, m);
+    v2d ed = __builtin_convertvector(e - big, v2d);
+
+    v2d f = m - 1.0;
+    v2d s = f / (2.0 + f);
+    v2d z = s * s;
+    v2d p = splat(1.0 / 21);
+    p = p * z + 1.0 / 19;
+    p = p * z + 1.0 / 17;
+    p = p * z + 1.0 / 15;
+    p = p * z + 1.0 / 13;
+    p = p * z + 1.0 / 11;
+    p = p * z + 1.0 / 9;
+    p = p * z + 1.0 / 7;
+    p = p * z + 1.0 / 5;
+    p = p * z + 1.0 / 3;
+
+    v2d r = ed * 0x1.62e42fee00000p-1 
+        + (ed * 0x1.a39ef35793c76p-33 + (2.0 * s + 2.0 * s * z * p));
+
+    r = blend(x == 0.0, splat(-INFINITY), r);
+    r = blend((x < 0.0) | (x != x), splat(NAN), r);
+    return blend(x == INFINITY, x, r);
+}
+
+// polinômios da fdlibm para |r| <= pi/4
+v2d sin_poly(v2d r)
+{
+    v2d z = r * r;
+    v2d p = splat(1.58969099521155010221e-10);
+    p = p * z - 2.50507602534068634195e-08;
+    p = p * z + 2.75573137070700676789e-06;
+    p = p * z - 1.98412698298579493134e-04;
+    p = p * z + 8.33333333332248946124e-03;
+    p = p * z - 1.66666666666666324348e-01;
+    return r + r * z * p;
+}
+
+v2d cos_poly(v2d r)
+{
+    v2d z = r * r;
+    v2d p = splat(-1.13596475577881948265e-11);
+    p = p * z + 2.08757232129817482790e-09;
+    p = p * z - 2.75573143513906633035e-07;
+    p = p * z + 2.48015872894767294178e-05;
+    p = p * z - 1.38888888888741095749e-03;
+    p = p * z + 4.16666666666666019037e-02;
+    v2d hz = 0.5 * z;
+    v2d w = 1.0 - hz;
+    return w + (((1.0 - w) - hz) + z * z * p);
+}
+
+// x = q pi/2 + r, com pi/2 em quatro partes (cody-waite), exato enquanto q
+// cabe em 20 bits. erro medido: <= 2 ulp para |x| < 1e6, acima disso (e
+// para inf e NaN) a libm resolve.
+v2d sin_or_cos(v2d x, int quadrant, double (*fallback)(double))
+{
+    v2d t = x * 0x1.45f306dc9c883p-1 + magic_round;
+    v2d q = t - magic_round;
+    v2l qi = (v2l) t - (v2l) splat(magic_round) + quadrant;
+
+    v2d r = x - q * 1.57079632673412561417e+00;
+    r = r - q * 6.07710050630396597660e-11;
+    r = r - q * 2.02226624871116645580e-21;
+    r = r - q * 8.47842766036889956997e-32;
+
+    v2d y = blend((qi & 1) != 0, cos_poly(r), sin_poly(r));
+    y = blend((qi & 2) != 0, -y, y);
+
+    v2l far = ~(v_abs(x) < 1e6);
+    if (far[0] | far[1])
+        for (int i = 0; i < 2; i++)
+            if (far[i])
+                y[i] = fallback(x[i]);
+    return y;
+}
+
+v2d v_sin(v2d x)
+{
+    return blend(x == 0.0, x, sin_or_cos(x, 0, sin));
+}
+
+v2d v_cos(v2d x)
+{
+    return sin_or_cos(x, 1, cos);
+}
+
+vector_kernel(abs)
+vector_kernel(not)
+vector_kernel(gt0)
+vector_kernel(lt0)
+vector_kernel(round)
+vector_kernel(sqrt)
+vector_kernel(exp)
+vector_kernel(log)
+vector_kernel(sin)
+vector_kernel(cos)
+
+// o mesmo cálculo para um número só, para constante e array darem igual
+double on_lane(v2d (*f)(v2d), double x)
+{
+    return f(splat(x))[0];
+}
+
+value ___abs(s24_vm*, value);
+value _not(s24_vm*, value);
+value _gt0(s24_vm*, value);
+value _lt0(s24_vm*, value);
+value ___round(s24_vm*, value);
+value ___sqrt(s24_vm*, value);
+value ___exp(s24_vm*, value);
+value ___log(s24_vm*, value);
+value ___sin(s24_vm*, value);
+value ___cos(s24_vm*, value);
+
+unary_kernel find_unary_kernel(value (*func)(s24_vm*, value))
+{
+    if (func == ___abs)   return abs_kernel;
+    if (func == _not)     return not_kernel;
+    if (func == _gt0)     return gt0_kernel;
+    if (func == _lt0)     return lt0_kernel;
+    if (func == ___round) return round_kernel;
+    if (func == ___sqrt)  return sqrt_kernel;
+    if (func == ___exp)   return exp_kernel;
+    if (func == ___log)   return log_kernel;
+    if (func == ___sin)   return sin_kernel;
+    if (func == ___cos)   return cos_kernel;
+    return NULL;
+}
+
+// cadeias de operações elemento a elemento sobre arrays grandes não montam
+// um array por passo: cada uma vira um nó, e forçar o último roda a cadeia
+// inteira de fuse_chunk em fuse_chunk elementos, sem sair do cache. o limite
+// de profundidade segura o uso da pilha de C (o wasm tem pouca).
+#define fuse_min_size 256
+#define fuse_chunk 128
+#define fuse_max_depth 8
+
+void run_chunk(deferred* d, int from, int n, double* out);
+
+// os elementos [from, from+n) de v: direto do buffer quando já existe,
+// senão calculados em buf. step 0 quando é uma constante.
+double* operand_chunk(value v, int from, int n, double* buf, int* step)
+{
+    *step = 1;
+    if (type_of(v) == constant)
+    {
+        *buf = as_constant(v);
+        *step = 0;
+        return buf;
+    }
+    if (type_of(v) == numbers)
+        return as_numbers(v) + from;
+
+    deferred* d = as_deferred(v);
+    if (!is_null(d->result))
+        return as_numbers(d->result) + from;
+    run_chunk(d, from, n, buf);
+    return buf;
+}
+
+void run_chunk(deferred* d, int from, int n, double* out)
+{
+    if (is_null(d->x))
+    {
+        for (int i = 0; i < n; i++)
+            out[i] = d->step == 0 ? d->from : d->from + (double) (from + i) * d->step;
+        return;
+    }
+
+    double xs[fuse_chunk], ys[fuse_chunk];
+    int sx, sy;
+    double* x = operand_chunk(d->x, from, n, xs, &sx);
+    if (d->unary != NULL)
+    {
+        d->unary(out, x, n);
+        return;
+    }
+
+    double* y = operand_chunk(d->y, from, n, ys, &sy);
+    if (d->binary != NULL)
+        d->binary(out, x, y, n, sx, sy);
     else
+        for (int i = 0; i < n; i++)
+            out[i] = d->numeric(x[i * sx], y[i * sy]);
+}
+
+value compute(s24_vm* vm, deferred* d)
+{
+    value r = new_numbers(vm, d->size);
+    for (int from = 0; from < d->size; from += fuse_chunk)
+    {
+        int n = d->size - from < fuse_chunk ? d->size - from : fuse_chunk;
+        run_chunk(d, from, n, as_numbers(r) + from);
+    }
+    return r;
+}
+
+// calcula uma vez e guarda, os operandos não servem mais depois disso.
+// não muda a posse de nada, o resultado é do nó.
+value evaluate(s24_vm* vm, value v)
+{
+    if (type_of(v) != lazy)
+        return v;
+
+    deferred* d = as_deferred(v);
+    if (is_null(d->result))
+    {
+        value r = compute(vm, d);
+        release(vm, d->x);
+        release(vm, d->y);
+        d->x = d->y = new_null();
+        d->result = r;
+    }
+    return d->result;
+}
+
+// um elemento só, sem forçar o resto
+double lazy_at(value v, int at)
+{
+    deferred* d = as_deferred(v);
+    if (!is_null(d->result))
+        return as_numbers(d->result)[at];
+
+    double x;
+    run_chunk(d, at, 1, &x);
+    return x;
+}
+
+bool is_range(value v)
+{
+    return type_of(v) == lazy && is_null(as_deferred(v)->x) 
+        && is_null(as_deferred(v)->result);
+}
+
+// troca a referência à lazy por uma ao resultado
+value force(s24_vm* vm, value v)
+{
+    if (type_of(v) != lazy)
+        return v;
+
+    // nó compartilhado entre workers não pode ser escrito, cada um calcula
+    // a sua cópia
+    if (header(as_payload(v))->shared && is_null(as_deferred(v)->result))
+    {
+        value r = compute(vm, as_deferred(v));
+        release(vm, v);
+        return r;
+    }
+
+    value r = retain(evaluate(vm, v));
+    release(vm, v);
+    return r;
+}
+
+int fuse_depth(value v)
+{
+    return type_of(v) == lazy ? as_deferred(v)->depth : 0;
+}
+
+// nós compartilhados ou fundos demais são calculados antes de entrar noutro,
+// para não repetir a conta nem estourar a pilha. ranges não custam nada pra
+// gerar de novo, então continuam lazy mesmo compartilhados.
+value fuse_operand(s24_vm* vm, value v)
+{
+    if (type_of(v) == lazy && !is_range(v) && (header(as_payload(v))->refs > 1 
+            || fuse_depth(v) >= fuse_max_depth || !is_null(as_deferred(v)->result)))
+        return force(vm, v);
+    return v;
+}
+
+bool fusible(value v)
+{
+    value_type t = type_of(v);
+    return t == constant || t == numbers || t == lazy;
+}
+
+// os dois do mesmo tamanho, ou um deles constante, e grandes o bastante
+bool can_fuse(value a, value b)
+{
+    if (!fusible(a) || !fusible(b) || (is_constant(a) && is_constant(b)))
+        return false;
+    if (!is_constant(a) && !is_constant(b) && size_of(a) != size_of(b))
+        return false;
+    return size_of(is_constant(a) ? b : a) >= fuse_min_size;
+}
+
+// fica com as referências de x e y
+value defer(s24_vm* vm, value x, value y, double (*numeric)(double,double), unary_kernel unary)
+{
+    x = fuse_operand(vm, x);
+    y = fuse_operand(vm, y);
+
+    deferred* d = object_alloc(vm, sizeof(deferred));
+    *d = (deferred) {
+        .x = x, .y = y,
+        .numeric = numeric,
+        .binary = numeric != NULL ? find_kernel(numeric) : NULL,
+        .unary = unary,
+        .size = size_of(is_constant(x) ? y : x),
+        .depth = 1 + (fuse_depth(x) > fuse_depth(y) ? fuse_depth(x) : fuse_depth(y)),
+        .result = new_null(),
+    };
+    return box_object(lazy, d, d->size);
+}
+
+// ran, ran2 e fll. os pequenos já saem prontos, os grandes ficam como uma
+// lazy que gera os elementos quando alguém pede.
+value new_range(s24_vm* vm, double from, double step, double count)
+{
+    if (!(count > 0))
+        return new_array(vm, 0);
+    if (count > INT_MAX)
+    {
+        bail(vm);
+        fprintf(stderr, "error: range too big!\n");
+        fail(vm);
+    }
+
+    int size = ceil(count);
+    if (size < fuse_min_size)
+    {
+        value r = new_numbers(vm, size);
+        for (int i = 0; i < size; i++)
+            as_numbers(r)[i] = step == 0 ? from : from + i * step;
+        return r;
+    }
+
+    deferred* d = object_alloc(vm, sizeof(deferred));
+    *d = (deferred) {
+        .x = new_null(), .y = new_null(),
+        .from = from, .step = step,
+        .size = size,
+        .depth = 1,
+        .result = new_null(),
+    };
+    return box_object(lazy, d, d->size);
+}
+
+// percorre dois layouts do mesmo shape escrevendo o resultado contíguo em out.
+// stride 0 repete o mesmo elemento, é assim que uma constante entra.
+double* zip(double* x, double* y, int rank, int* shape, int* sx, int* sy, 
+        double* out, double (*numeric)(double,double))
+{
+    if (rank == 1)
+    {
+        kernel k = find_kernel(numeric);
+        if (k != NULL && (sx[0] == 0 || sx[0] == 1) && (sy[0] == 0 || sy[0] == 1))
+        {
+            k(out, x, y, shape[0], sx[0], sy[0]);
+            return out + shape[0];
+        }
+        for (int i = 0; i < shape[0]; i++)
+            *out++ = numeric(x[i * sx[0]], y[i * sy[0]]);
+        return out;
+    }
+    for (int i = 0; i < shape[0]; i++)
+        out = zip(x + i * sx[0], y + i * sy[0], 
+                rank - 1, shape + 1, sx + 1, sy + 1, out, numeric);
+    return out;
+}
+
+// operações que só dão 0 ou 1, os resultados delas viram bits
+bool is_boolean(double (*numeric)(double,double))
+{
+    return numeric == __equal_numeric || numeric == __or_numeric 
+        || numeric == __and_numeric;
+}
+
+value binary_op(s24_vm*, value, value, value (*)(s24_vm*, value, value), double (*)(double,double));
+value _binary_broadcast(s24_vm*, value, value);
+bool parallel_broadcast(s24_vm*, value*, int, value, value, bool);
+
+// and, or e = entre dois bits vão de palavra em palavra. o resto desempacota
+// e segue como numbers.
+value binary_bits(s24_vm* vm, value val1, value val2, 
+        value (*func)(s24_vm*, value, value), double (*numeric)(double,double)) 
+{
+    if (type_of(val1) == bits && type_of(val2) == bits 
+            && size_of(val1) == size_of(val2) && is_boolean(numeric))
+    {
+        int size = size_of(val1);
+        value r = new_bits(vm, size);
+        uint64_t* x = as_words(val1);
+        uint64_t* y = as_words(val2);
+        uint64_t* out = as_words(r);
+        for (int i = 0; i < word_count(size); i++)
+            out[i] = numeric == __and_numeric ? x[i] & y[i]
+                : numeric == __or_numeric ? x[i] | y[i]
+                : ~(x[i] ^ y[i]);
+        return trim_bits(r);
+    }
+
+    value x = unpack(vm, val1), y = unpack(vm, val2);
+    keep(vm, &x, 1);
+    keep(vm, &y, 1);
+    value r = binary_op(vm, x, y, func, numeric);
+    drop(vm, 2);
+    release(vm, x);
+    release(vm, y);
+    return r;
+}
+
+// numeric é a mesma operação só sobre doubles, usada quando os dois lados
+// são números e não precisa passar por value nenhum
+value binary_op(s24_vm* vm, value val1, value val2, 
+        value (*func)(s24_vm*, value, value), double (*numeric)(double,double)) 
+{
+    if (numeric != NULL && type_of(val1) == constant && type_of(val2) == constant)
+        return new_constant(numeric(as_constant(val1), as_constant(val2)));
+
+    if (type_of(val1) == bits || type_of(val2) == bits)
+        return binary_bits(vm, val1, val2, func, numeric);
+
+    double c1, c2;
+    if (numeric != NULL && is_constant_or_numbers(val1) && is_constant_or_numbers(val2))
+    {
+        c1 = as_constant(val1), c2 = as_constant(val2);
+        double* x = type_of(val1) == numbers ? as_numbers(val1) : &c1;
+        double* y = type_of(val2) == numbers ? as_numbers(val2) : &c2;
+        int size1 = type_of(val1) == numbers ? size_of(val1) : 1;
+        int size2 = type_of(val2) == numbers ? size_of(val2) : 1;
+
+        if (size1 > 1 && size2 > 1 && size1 != size2) 
+        {
+            bail(vm);
+            fprintf(stderr, "error: size mismatch (%d x %d)!\n", size1, size2);
+            fail(vm);
+        }
+
+        int size = max(size1, size2);
+        if (size == 1)
+            return new_constant(numeric(*x, *y));
+
+        int step1 = size1 > 1, step2 = size2 > 1;
+        kernel k = find_kernel(numeric);
+        if (is_boolean(numeric))
+        {
+            value r = new_bits(vm, size);
+            double chunk[64];
+            for (int i = 0; i < size; i += 64)
+            {
+                int n = size - i < 64 ? size - i : 64;
+                k(chunk, x + i * step1, y + i * step2, n, step1, step2);
+                as_words(r)[i >> 6] = pack_word(chunk, n);
+            }
+            return r;
+        }
+
+        value arr = new_numbers(vm, size);
+        if (k != NULL)
+            k(as_numbers(arr), x, y, size, step1, step2);
+        else
+            for (int i = 0; i < size; i++)
+                as_numbers(arr)[i] = numeric(x[i*step1], y[i*step2]);
         return arr;
+    }
+
+    // views do mesmo shape, ou uma view e uma constante, vão direto nos buffers
+    if (numeric != NULL 
+        && (type_of(val1) == view || type_of(val2) == view)
+        && is_numeric(val1) && is_numeric(val2))
+    {
+        layout x = describe(val1), y = describe(val2);
+        if (x.rank == 0 || y.rank == 0 || same_shape(&x, &y))
+        {
+            layout* shape = x.rank > 0 ? &x : &y;
+            if (x.rank == 0)
+            {
+                x = (layout) { .data = &c1, .rank = y.rank };
+                c1 = as_constant(val1);
+            }
+            if (y.rank == 0)
+            {
+                y = (layout) { .data = &c2, .rank = x.rank };
+                c2 = as_constant(val2);
+            }
+
+            double* out;
+            value r = new_dense(vm, shape->rank, shape->shape, &out);
+            zip(x.data, y.data, shape->rank, shape->shape, x.stride, y.stride, out, numeric);
+            if (is_boolean(numeric) && type_of(r) == numbers)
+                r = numbers_to_bits(vm, r);
+            return r;
+        }
+    }
+
+    int size1 = operand_size(val1), size2 = operand_size(val2);
+    if (size1 > 1 && size2 > 1 && size1 != size2) 
+    {
+        bail(vm);
+        fprintf(
+            stderr,
+            "error: size mismatch (%d x %d)!\n",
+            size1, size2);
+        // free_vm() é o melhor free() de todos
+        fail(vm);
+    }
+
+    int size = max(size1, size2);
+    keep(vm, &val1, 1);
+    keep(vm, &val2, 1);
+    if (size == 1)
+    {
+        value r = apply2_at(vm, func, val1, val2, 0);
+        drop(vm, 2);
+        return r;
+    }
+
+    region_mark m = mark_region(vm);
+    value* items = region_alloc(vm, sizeof(value) * size);
+    memset(items, 0, sizeof(value) * size);
+    keep(vm, items, size);
+    if (func != _binary_broadcast || !parallel_broadcast(vm, items, size, val1, val2, true))
+        for (int i = 0; i < size; i++) 
+            items[i] = apply2_at(vm, func, val1, val2, i);
+    drop(vm, 3);
+
+    value r = gather(vm, items, size);
+    release_region(vm, m);
+    if (is_boolean(numeric) && type_of(r) == numbers)
+        r = numbers_to_bits(vm, r);
+    return r;
 }
 
+// os operandos são emprestados, o resultado é sempre uma referência nova
+value binary_builtin(s24_vm* vm, value (*func)(s24_vm*, value, value), double (*numeric)(double,double))
+{
+    value b = pop_lazy(vm), a = pop_lazy(vm);
+    if (numeric != NULL && !is_boolean(numeric) && can_fuse(a, b))
+        return defer(vm, a, b, numeric, NULL);
+    a = force(vm, a), b = force(vm, b);
+
+    keep(vm, &a, 1);
+    keep(vm, &b, 1);
+    value r = binary_op(vm, a, b, func, numeric);
+    drop(vm, 2);
+    release(vm, a);
+    release(vm, b);
+    return r;
+}
+
+// constant_handling é escrito sobre os doubles x e y
 #define binary_op_type_handling(name, \
 constant_handling, character_handling, string_handling) \
-value name(value a, value b) { \
+double name##_numeric(double x, double y) { \
+    return constant_handling; \
+} \
+value name(s24_vm* vm, value a, value b) { \
     if (is_constant(a) && is_constant(b)) { \
-        return new_constant(constant_handling); \
+        return new_constant(name##_numeric(as_constant(a), as_constant(b))); \
     } \
     else if (is_char(a) && is_char(b)) { \
         character_handling; \
@@ -557,169 +2412,199 @@ value name(value a, value b) { \
         string_handling \
     } \
     if (is_constant(a) && is_string(b)) { \
-        return name(a, string_to_constant(b)); \
+        return name(vm, a, string_to_constant(vm, b)); \
     } \
     else if (is_string(a) && is_constant(b)) { \
-        return name(string_to_constant(a), b); \
+        return name(vm, string_to_constant(vm, a), b); \
     } \
     if (is_array(a) || is_array(b)) { \
-        return binary_op(a, b, name); \
+        return binary_op(vm, a, b, name, name##_numeric); \
     } \
     if (is_char(a) && !is_char(b)) { \
-        return binary_op(new_constant(a.data.c), b, name); \
+        return binary_op(vm, new_constant(as_char(a)), b, name, name##_numeric); \
     } \
     else if (!is_char(a) && is_char(b)) { \
-        return binary_op(a, new_constant(b.data.c), name); \
+        return binary_op(vm, a, new_constant(as_char(b)), name, name##_numeric); \
     } \
     assert(false); \
 }
 
 #define binary_type_handler_op_not_defined_error(operation, handler) \
+bail(vm); \
 fprintf( \
         stderr, \
         "error: %s operation between %ss not defined!\n", \
         operation, handler); \
-exit(1); \
+fail(vm); \
 
 
 binary_op_type_handling(
     __sum, 
-    get_constant(a) + get_constant(b),
+    x + y,
     {
-        return new_character(a.data.c + b.data.c);
+        return new_character(as_char(a) + as_char(b));
     },
     {
-        value n = copy(b);
-        for (int i = 0; i < a.size; i++) 
-        {
-            array_append(&n, array_at(a, i));
-        }
+        value n = new_string(vm, size_of(b) + size_of(a));
+        memcpy(as_bytes(n), as_bytes(b), size_of(b));
+        memcpy(as_bytes(n) + size_of(b), as_bytes(a), size_of(a));
         return n;
     }
 );
 
-value sum()
+value sum(s24_vm* vm)
 {
-    return binary_op(pop(), pop(), __sum);
+    return binary_builtin(vm, __sum, __sum_numeric);
 }
 
 binary_op_type_handling(
     __sub, 
-    get_constant(a) - get_constant(b),
+    x - y,
     {
-        return new_character(a.data.c - b.data.c);
+        return new_character(as_char(a) - as_char(b));
     },
     binary_type_handler_op_not_defined_error("subtraction", "string")
 );
 
 
-value subtraction()
+value subtraction(s24_vm* vm)
 {
-    value subtrahend = pop(), minuend = pop();
-    return binary_op(minuend, subtrahend, __sub);
+    return binary_builtin(vm, __sub, __sub_numeric);
 }
 
 binary_op_type_handling(
     __mul, 
-    get_constant(a) * get_constant(b),
+    x * y,
     {
-        return new_character(a.data.c * b.data.c);
+        return new_character(as_char(a) * as_char(b));
     },
     binary_type_handler_op_not_defined_error("multiplication", "string")
 );
 
-value multiplication()
+value multiplication(s24_vm* vm)
 {
-    return binary_op(pop(), pop(), __mul);
+    return binary_builtin(vm, __mul, __mul_numeric);
 }
 
 binary_op_type_handling(
     __div, 
-    a.data.constant / b.data.constant,
+    x / y,
     {
-        return new_character(a.data.c * b.data.c);
+        return new_character(as_char(a) * as_char(b));
     },
     {
-        return __sum(__sum(a, from_string("/")), b);
+        value slash = from_string(vm, "/");
+        value left = __sum(vm, a, slash);
+        value path = __sum(vm, left, b);
+        release(vm, slash);
+        release(vm, left);
+        return path;
     }
 );
 
 
-value division()
+value division(s24_vm* vm)
 {
-    value divisor = pop(), dividend = pop();
-    return binary_op(dividend, divisor, __div);
+    return binary_builtin(vm, __div, __div_numeric);
 }
 
 binary_op_type_handling(
     ___pow, 
-    pow(a.data.constant, b.data.constant),
+    pow(x, y),
     binary_type_handler_op_not_defined_error("power", "character"),
     binary_type_handler_op_not_defined_error("power", "string")
 );
 
-value power()
+value power(s24_vm* vm)
 {
-    value exponent = pop(), base = pop();
-    return binary_op(base, exponent, ___pow);
+    return binary_builtin(vm, ___pow, ___pow_numeric);
 }
 
 binary_op_type_handling(
     __mod, 
-    fmodl(a.data.constant, b.data.constant),
+    fmodl(x, y),
     binary_type_handler_op_not_defined_error("modulo", "character"),
     binary_type_handler_op_not_defined_error("modulo", "string")
 );
 
-value mod() 
+value mod(s24_vm* vm) 
 {
-    value divisor = pop(), dividend = pop();
-    return binary_op(dividend, divisor, __mod);
+    return binary_builtin(vm, __mod, __mod_numeric);
 }
 
 binary_op_type_handling(
     __equal, 
-    a.data.constant == b.data.constant,
+    x == y,
     {
-        return new_constant(a.data.c == b.data.c);
+        return new_constant(as_char(a) == as_char(b));
     },
     {
-        if (a.size != a.size) 
+        if (size_of(a) != size_of(b)) 
             return new_constant(false);
 
-        for (int i = 0; i < a.size; i++) 
-        {
-            if (array_at(a, i).data.c != array_at(b, i).data.c) 
-            {
-                return new_constant(false);
-            }
-        }
-        return new_constant(true);
+        return new_constant(memcmp(as_bytes(a), as_bytes(b), size_of(a)) == 0);
     }
 
 );
 
-value equal() 
+value equal(s24_vm* vm) 
 {
-    return binary_op(pop(), pop(), __equal);
+    return binary_builtin(vm, __equal, __equal_numeric);
 }
 
 binary_op_type_handling(
     __or, 
-    a.data.constant || b.data.constant,
+    x || y,
     binary_type_handler_op_not_defined_error("or", "character"),
     binary_type_handler_op_not_defined_error("or", "string")
 );
 
 
-value or() 
+value or(s24_vm* vm) 
+{
+    return binary_builtin(vm, __or, __or_numeric);
+}
+
+binary_op_type_handling(
+    __and, 
+    x && y,
+    binary_type_handler_op_not_defined_error("and", "character"),
+    binary_type_handler_op_not_defined_error("and", "string")
+);
+
+value and(s24_vm* vm) 
+{
+    return binary_builtin(vm, __and, __and_numeric);
+}
+
+// empate e NaN ficam com o da esquerda, como min_pd(y, x)
+binary_op_type_handling(
+    __min, 
+    y < x ? y : x,
+    binary_type_handler_op_not_defined_error("min", "character"),
+    binary_type_handler_op_not_defined_error("min", "string")
+);
+
+value _min(s24_vm* vm) 
+{
+    return binary_builtin(vm, __min, __min_numeric);
+}
+
+binary_op_type_handling(
+    __max, 
+    y > x ? y : x,
+    binary_type_handler_op_not_defined_error("max", "character"),
+    binary_type_handler_op_not_defined_error("max", "string")
+);
+
+value _max(s24_vm* vm) 
 {
-    return binary_op(pop(), pop(), __or);
+    return binary_builtin(vm, __max, __max_numeric);
 }
 
 // binary_op_type_handling(
 //     __mask, 
-//     a.data.constant || b.data.constant,
+//     as_constant(a) || as_constant(b),
 //     binary_type_handler_op_not_defined_error("or", "character"),
 //     binary_type_handler_op_not_defined_error("or", "string")
 // );
@@ -730,68 +2615,380 @@ value or()
 //     return binary_op(pop(), pop(), __mask);
 // }
 
-value mask() 
+// popcount dá o tamanho, e o laço só visita os bits ligados
+int count_bits(value mask)
+{
+    int count = 0;
+    for (int i = 0; i < word_count(size_of(mask)); i++)
+        count += __builtin_popcountll(as_words(mask)[i]);
+    return count;
+}
+
+#define for_each_bit(mask, i) \
+    for (int w_ = 0; w_ < word_count(size_of(mask)); w_++) \
+        for (uint64_t b_ = as_words(mask)[w_], i; \
+                b_ != 0 && (i = w_ * 64 + __builtin_ctzll(b_), true); b_ &= b_ - 1)
+
+value select_bits(s24_vm* vm, value mask, value filter)
+{
+    int j = 0;
+    if (type_of(filter) == numbers)
+    {
+        value r = new_numbers(vm, count_bits(mask));
+        for_each_bit(mask, i)
+            as_numbers(r)[j++] = as_numbers(filter)[i];
+        return r;
+    }
+
+    value r = new_array(vm, count_bits(mask));
+    for_each_bit(mask, i)
+        as_array(r)[j++] = array_at(vm, filter, i);
+    return pack(vm, r);
+}
+
+value mask(s24_vm* vm) 
+{
+    value mask = pop(vm), filter = pop(vm);
+
+    if (size_of(mask) != size_of(filter)) 
+    {
+        bail(vm);
+        fprintf(stderr, "error: mask and array have different sizes!\n");
+        fail(vm);
+    }
+    if (type_of(mask) == bits)
+    {
+        value arr = select_bits(vm, mask, filter);
+        release(vm, mask);
+        release(vm, filter);
+        return arr;
+    }
+
+    // conta antes, e o resultado já nasce do tamanho certo
+    int count = 0;
+    for (int i = 0; i < size_of(mask); i++) 
+        count += get_constant(array_at(vm, mask, i)) == 1.0;
+
+    value arr = new_array(vm, count);
+    for (int i = 0, j = 0; i < size_of(mask); i++) 
+        if (get_constant(array_at(vm, mask, i)) == 1.0) 
+            as_array(arr)[j++] = array_at(vm, filter, i);
+
+    release(vm, mask);
+    release(vm, filter);
+    return pack(vm, arr);
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+// unary built-ins
+
+bool is_boolean_kernel(unary_kernel k)
+{
+    return k == not_kernel || k == gt0_kernel || k == lt0_kernel;
+}
+
+// numbers e views passam inteiros pelo kernel, sem value por elemento.
+// comparações de rank 1 saem direto em bits.
+value map_kernel(s24_vm* vm, value v, unary_kernel k)
+{
+    region_mark m = mark_region(vm);
+    int size;
+    double* x = is_boolean_kernel(k) ? numbers_of(vm, v, &size) : NULL;
+    if (x != NULL)
+    {
+        value r = new_bits(vm, size);
+        double chunk[64];
+        for (int i = 0; i < size; i += 64)
+        {
+            int n = size - i < 64 ? size - i : 64;
+            k(chunk, x + i, n);
+            as_words(r)[i >> 6] = pack_word(chunk, n);
+        }
+        release_region(vm, m);
+        return r;
+    }
+    release_region(vm, m);
+
+    layout l = describe(v);
+    double* out;
+    value r = new_dense(vm, l.rank, l.shape, &out);
+    int count = layout_count(&l);
+    if (l.rank == 1 && l.stride[0] == 1)
+        k(out, l.data, count);
+    else
+    {
+        flatten(l.data, l.rank, l.shape, l.stride, out);
+        k(out, out, count);
+    }
+    return r;
+}
+
+// primos. um crivo só serve a lista inteira quando o maior elemento não é
+// grande demais perto da quantidade de elementos; senão divisão mesmo.
+#define sieve_limit (1 << 28)
+#define sieve_segment (1 << 18)
+#define factor_limit (1 << 24)
+
+bool worth_sieving(double max, int size)
+{
+    return max <= sieve_limit && max <= (double) size * sqrt(max) * 4;
+}
+
+bool trial_prime(double d)
 {
-    value mask = pop(), filter = pop();
+    if (!(d >= 2) || d >= 9e18)
+        return false;
+
+    int64_t x = d;
+    if (x < 4)
+        return true;
+    if (x % 2 == 0 || x % 3 == 0)
+        return false;
+    for (int64_t i = 5; i * i <= x; i += 6)
+        if (x % i == 0 || x % (i + 2) == 0)
+            return false;
+    return true;
+}
 
-    if (mask.size != filter.size) 
-    {
-        fprintf(stderr, "error: mask and array have different sizes!\n");
-        exit(1);
-    }
-    value arr = new_array(0);
-    for (int i = 0; i < mask.size; i++) 
+// bits ligados são os ímpares compostos, o índice i é o número 2i+1.
+// o crivo anda em segmentos pra ficar no cache.
+uint64_t* odd_composites(s24_vm* vm, int max)
+{
+    int count = max / 2 + 1;
+    uint64_t* composite = region_alloc(vm, sizeof(uint64_t) * word_count(count));
+    memset(composite, 0, sizeof(uint64_t) * word_count(count));
+    composite[0] = 1;
+
+    int root = sqrt(max);
+    char* small = region_alloc(vm, root + 1);
+    memset(small, 0, root + 1);
+    for (int i = 2; i * i <= root; i++)
+        if (!small[i])
+            for (int j = i * i; j <= root; j += i)
+                small[j] = 1;
+
+    for (int lo = 0; lo < count; lo += sieve_segment)
     {
-
-        if (get_constant(array_at(mask, i)) == 1.0) 
+        int hi = lo + sieve_segment < count ? lo + sieve_segment : count;
+        for (int p = 3; p <= root; p += 2)
         {
-            array_append(&arr, array_at(filter, i));
+            if (small[p])
+                continue;
+            int64_t start = (int64_t) p * p;
+            int64_t first = 2 * (int64_t) lo + 1;
+            if (start < first)
+                start = first + ((p - first % p) % p);
+            if (start % 2 == 0)
+                start += p;
+            for (int64_t i = start >> 1; i < hi; i += p)
+                composite[i >> 6] |= (uint64_t) 1 << (i & 63);
         }
     }
-    return arr;
+    return composite;
 }
 
+// ipr de uma lista inteira pelo crivo. null quando não compensa.
+value sieve_primes(s24_vm* vm, value v)
+{
+    region_mark m = mark_region(vm);
+    int size;
+    double* x = numbers_of(vm, v, &size);
+    double max = 0;
+    for (int i = 0; x != NULL && i < size; i++)
+        if (x[i] > max || x[i] != x[i])
+            max = x[i] != x[i] ? INFINITY : x[i];
 
+    if (x == NULL || !worth_sieving(max, size))
+    {
+        release_region(vm, m);
+        return new_null();
+    }
 
+    uint64_t* composite = odd_composites(vm, max);
+    value r = new_bits(vm, size);
+    for (int i = 0; i < size; i++)
+    {
+        int64_t n = x[i] >= 2 ? (int64_t) x[i] : 0;
+        bool prime = n == 2 || (n % 2 == 1 && !((composite[n >> 7] >> ((n >> 1) & 63)) & 1));
+        as_words(r)[i >> 6] |= (uint64_t) prime << (i & 63);
+    }
+    release_region(vm, m);
+    return r;
+}
 
+// menor fator primo de cada número até max
+int* smallest_factors(s24_vm* vm, int max)
+{
+    int* spf = region_alloc(vm, sizeof(int) * (max + 1));
+    memset(spf, 0, sizeof(int) * (max + 1));
+    for (int i = 2; i <= max; i++)
+        if (spf[i] == 0)
+            for (int64_t j = i; j <= max; j += i)
+                if (spf[j] == 0)
+                    spf[j] = i;
+    return spf;
+}
 
+// fatores primos de d em ordem, com repetição. usa a tabela enquanto o
+// que sobra cabe nela.
+value factors_of(s24_vm* vm, double d, int* spf, int max)
+{
+    double out[64];
+    int count = 0;
+    if (d >= 2 && d < 9e18)
+    {
+        int64_t x = d;
+        for (int64_t p = 2; x > max && p * p <= x; p += p == 2 ? 1 : 2)
+            for (; x % p == 0; x /= p)
+                out[count++] = p;
+        if (x > max && x > 1)
+        {
+            out[count++] = x;
+            x = 1;
+        }
+        for (; x > 1; x /= spf[x])
+            out[count++] = spf[x];
+    }
 
+    if (count == 0)
+        return new_array(vm, 0);
+    value r = new_numbers(vm, count);
+    memcpy(as_numbers(r), out, sizeof(double) * count);
+    return r;
+}
 
+value _is_prime(s24_vm*, value);
+value _factor(s24_vm*, value);
+value _unary_broadcast(s24_vm*, value);
 
+// fac numa lista inteira monta a tabela uma vez só
+value factor_all(s24_vm* vm, value v)
+{
+    region_mark m = mark_region(vm);
+    int size;
+    double* x = numbers_of(vm, v, &size);
+    double max = 0;
+    for (int i = 0; i < size; i++)
+        if (x[i] > max)
+            max = x[i];
+
+    int table = max <= factor_limit && max <= (double) size * 64 ? max : 0;
+    int* spf = table > 0 ? smallest_factors(vm, table) : NULL;
+
+    value* items = region_alloc(vm, sizeof(value) * size);
+    memset(items, 0, sizeof(value) * size);
+    keep(vm, items, size);
+    for (int i = 0; i < size; i++)
+        items[i] = factors_of(vm, x[i], spf, table);
+    drop(vm, 1);
+
+    value r = gather(vm, items, size);
+    release_region(vm, m);
+    return r;
+}
 
+value unary_op(s24_vm* vm, value v, value (*func)(s24_vm*, value)) 
+{
+    if (type_of(v) == bits)
+    {
+        if (func == _not)
+        {
+            value r = new_bits(vm, size_of(v));
+            for (int i = 0; i < word_count(size_of(v)); i++)
+                as_words(r)[i] = ~as_words(v)[i];
+            return trim_bits(r);
+        }
 
+        value x = unpack(vm, v);
+        keep(vm, &x, 1);
+        value r = unary_op(vm, x, func);
+        drop(vm, 1);
+        release(vm, x);
+        return r;
+    }
 
+    unary_kernel k = find_unary_kernel(func);
+    if (k != NULL && (type_of(v) == numbers || type_of(v) == view))
+        return map_kernel(vm, v, k);
 
+    if (func == _is_prime && (type_of(v) == numbers || type_of(v) == view))
+    {
+        value r = sieve_primes(vm, v);
+        if (!is_null(r))
+            return r;
+    }
+    if (func == _factor && (type_of(v) == numbers || type_of(v) == view) 
+            && describe(v).rank == 1)
+        return factor_all(vm, v);
 
-// unary built-ins
+    int size = operand_size(v);
+    keep(vm, &v, 1);
+    if (size == 1)
+    {
+        value r = apply_at(vm, func, v, 0);
+        drop(vm, 1);
+        return r;
+    }
 
-value unary_op(value v, value (*func)(value)) 
-{
-    v = coerce_to_array(v);
+    region_mark m = mark_region(vm);
+    value* items = region_alloc(vm, sizeof(value) * size);
+    memset(items, 0, sizeof(value) * size);
+    keep(vm, items, size);
 
-    int size = v.size;
-    value arr = new_array(size);
+    if (func != _unary_broadcast || !parallel_broadcast(vm, items, size, v, new_null(), false))
+        for (int i = 0; i < size; i++) 
+            items[i] = apply_at(vm, func, v, i);
+    drop(vm, 2);
 
-    for (int i = 0; i < size; i++) 
-        arr.data.array[i] = func(v.data.array[i]);
+    value r = gather(vm, items, size);
+    release_region(vm, m);
+    if (func == _is_prime && type_of(r) == numbers)
+        r = numbers_to_bits(vm, r);
+    return r;
+}
 
-    if (size == 1)
-        return array_at(arr, 0);
-    else
-        return arr;
+value unary_builtin(s24_vm* vm, value (*func)(s24_vm*, value)) 
+{
+    value v = pop_lazy(vm);
+    unary_kernel k = find_unary_kernel(func);
+    if (k != NULL && !is_boolean_kernel(k) 
+            && (type_of(v) == numbers || type_of(v) == lazy) 
+            && size_of(v) >= fuse_min_size)
+        return defer(vm, v, new_null(), NULL, k);
+    // o $. lê elemento a elemento, não precisa do array pronto
+    if (func != _unary_broadcast)
+        v = force(vm, v);
+
+    keep(vm, &v, 1);
+    value r = unary_op(vm, v, func);
+    drop(vm, 1);
+    release(vm, v);
+    return r;
 }
 
 #define unary_type_handler_op_not_defined_error(operation, handler) \
+bail(vm); \
 fprintf( \
         stderr, \
         "error: %s operation for %ss not defined!\n", \
         operation, handler); \
-exit(1);
+fail(vm);
 
 #define unary_op_type_handling(name, \
 constant_handling, character_handling, string_handling) \
-value name(value v) { \
-    switch (v.type) { \
+value name(s24_vm* vm, value v) { \
+    switch (type_of(v)) { \
         case constant: \
             constant_handling; \
             break; \
@@ -802,7 +2999,9 @@ value name(value v) { \
             string_handling; \
             break; \
         case array: \
-            return unary_op(v, name); \
+        case numbers: \
+        case view: \
+            return unary_op(vm, v, name); \
             break; \
         default: \
             assert(false); \
@@ -814,83 +3013,83 @@ value name(value v) { \
 unary_op_type_handling(
     _is_prime, 
     {
-        int x = get_constant(v);
-        if (x <= 1)
-            return new_constant(false);
-
-        double sqroot = sqrtl(x);
-        bool is_prime = true;
-
-        for (double i = 2; i <= sqroot; i++) 
-            if (fmodl(x, i) == 0) 
-            {
-                is_prime = false;
-                break;
-            }
+        return new_constant(trial_prime(get_constant(v)));
+    },
+    {
+        return _is_prime(vm, new_constant(as_char(v)));
+    },
+    {
+        return _is_prime(vm, string_to_constant(vm, v));
+    }
+)
 
-        return new_constant(is_prime);
+unary_op_type_handling(
+    _factor, 
+    {
+        return factors_of(vm, get_constant(v), NULL, 0);
     },
     {
-        return _is_prime(new_constant(v.data.c));
+        return _factor(vm, new_constant(as_char(v)));
     },
     {
-        return _is_prime(string_to_constant(v));
+        return _factor(vm, string_to_constant(vm, v));
     }
 )
 
 unary_op_type_handling(
     _gt0, 
     {
-        return new_constant(v.data.constant > 0);
+        return new_constant(as_constant(v) > 0);
     },
     {
-        return _gt0(new_constant(v.data.c));
+        return _gt0(vm, new_constant(as_char(v)));
     }, 
     {
-        return _gt0(string_to_constant(v));
+        return _gt0(vm, string_to_constant(vm, v));
     }
 )
 
-value  gt0()
+value  gt0(s24_vm* vm)
 {
-    return unary_op(pop(), _gt0);
+    return unary_builtin(vm, _gt0);
 }
 
 unary_op_type_handling(
     _lt0, 
     {
-        return new_constant(v.data.constant < 0);
+        return new_constant(as_constant(v) < 0);
     },
     {
-        return _gt0(new_constant(v.data.c));
+        return _gt0(vm, new_constant(as_char(v)));
     }, 
     {
-        return _gt0(string_to_constant(v));
+        return _gt0(vm, string_to_constant(vm, v));
     }
 )
 
-value  lt0()
+value  lt0(s24_vm* vm)
 {
-    return unary_op(pop(), _lt0);
+    return unary_builtin(vm, _lt0);
 }
 
 unary_op_type_handling(
     _not, 
     {
-        return new_constant(!v.data.constant);
+        return new_constant(!as_constant(v));
     },
     {
-        return _gt0(new_constant(v.data.c));
+        return _gt0(vm, new_constant(as_char(v)));
     }, 
     {
-        return _gt0(string_to_constant(v));
+        return _gt0(vm, string_to_constant(vm, v));
     }
 )
 
 unary_op_type_handling(
     ___round, 
     {
-        return new_constant(lroundf(v.data.constant));
+        // + 0.0 tira o sinal de -0, igual ao round_kernel
+        return new_constant(roundf(as_constant(v)) + 0.0);
     },
     {
         return v;
@@ -901,7 +3100,7 @@ unary_op_type_handling(
 unary_op_type_handling(
     ___abs, 
     {
-        return new_constant(fabsl(v.data.constant));
+        return new_constant(fabsl(as_constant(v)));
     },
     {
         return v;
@@ -909,934 +3108,1696 @@ unary_op_type_handling(
     unary_type_handler_op_not_defined_error("round", "string")
 )
 
-value  not()
+unary_op_type_handling(
+    ___sqrt, 
+    {
+        return new_constant(sqrt(as_constant(v)));
+    },
+    {
+        return ___sqrt(vm, new_constant(as_char(v)));
+    }, 
+    {
+        return ___sqrt(vm, string_to_constant(vm, v));
+    }
+)
+
+#define unary_math(name) \
+unary_op_type_handling( \
+    ___##name, \
+    { \
+        return new_constant(on_lane(v_##name, as_constant(v))); \
+    }, \
+    { \
+        return ___##name(vm, new_constant(as_char(v))); \
+    }, \
+    { \
+        return ___##name(vm, string_to_constant(vm, v)); \
+    } \
+)
+
+unary_math(exp)
+unary_math(log)
+unary_math(sin)
+unary_math(cos)
+
+value  not(s24_vm* vm)
 {
-    return unary_op(pop(), _not);
+    return unary_builtin(vm, _not);
 }
 
-value is_prime()
+value is_prime(s24_vm* vm)
 {
-    return unary_op(pop(), _is_prime);
+    return unary_builtin(vm, _is_prime);
 }
 
-value _round()
+value factor(s24_vm* vm)
 {
-    return unary_op(pop(), ___round);
+    return unary_builtin(vm, _factor);
 }
 
-value _abs()
+value _round(s24_vm* vm)
 {
-    return unary_op(pop(), ___abs);
+    return unary_builtin(vm, ___round);
 }
 
-value _cos()
+value _abs(s24_vm* vm)
 {
-    fprintf(stderr, "not implmemented yet");
-    exit(1);
+    return unary_builtin(vm, ___abs);
 }
 
-value _sin()
+value _cos(s24_vm* vm)
 {
-    fprintf(stderr, "not implmemented yet");
-    exit(1);
+    return unary_builtin(vm, ___cos);
+}
+
+value _sin(s24_vm* vm)
+{
+    return unary_builtin(vm, ___sin);
+}
+
+value _exp(s24_vm* vm)
+{
+    return unary_builtin(vm, ___exp);
+}
+
+value _log(s24_vm* vm)
+{
+    return unary_builtin(vm, ___log);
+}
+
+value _sqrt(s24_vm* vm)
+{
+    return unary_builtin(vm, ___sqrt);
 }
 
 
 // special
 
 
-value list() 
+value list(s24_vm* vm) 
 {
-    value take = pop();
+    value take = pop(vm);
     int size = get_constant(take);
-    size = size == -1 ? stack_size : size;
+    size = size == -1 ? vm->stack_size : size;
+
+    // num worker o que está abaixo de stack_floor é da vm que chamou, e o
+    // force() ali soltaria uma referência que não é nossa
+    if (size > vm->stack_size - vm->stack_floor)
+        bail(vm);
+
+    for (int i = 0; i < size && i < vm->stack_size; i++)
+        vm->stack[vm->stack_size - i - 1] = force(vm, vm->stack[vm->stack_size - i - 1]);
+
+    bool all_constants = size > 0 && size <= vm->stack_size;
+    for (int i = 0; i < size && all_constants; i++) 
+        all_constants = is_constant(vm->stack[vm->stack_size - i - 1]);
 
-    value arr = new_array(size);
+    if (all_constants)
+    {
+        value arr = new_numbers(vm, size);
+        for (int i = 0; i < size; i++) 
+            as_numbers(arr)[size - i - 1] = get_constant(pop(vm));
+        return arr;
+    }
+
+    if (size > 0 && size <= vm->stack_size)
+    {
+        value matrix = stack_rows(vm, vm->stack + vm->stack_size - size, size);
+        if (!is_null(matrix))
+        {
+            for (int i = 0; i < size; i++)
+                release(vm, pop(vm));
+            return matrix;
+        }
+    }
+
+    value arr = new_array(vm, size);
 
     for (int i = 0; i < size; i++) 
     {
-        arr.data.array[size - i - 1] = pop();
+        as_array(arr)[size - i - 1] = pop(vm);
     }
 
     return arr;
 }
-void clear() 
+void clear(s24_vm* vm) 
 {
-    int ss = stack_size;
+    int ss = vm->stack_size;
     for (int i = 0; i < ss; i++)
-        pop();
+        release(vm, pop(vm));
 }
 
-// todo: pra std
-// value range() {
-//     value to = pop(), from = pop();
-//
-//     int size = get_constant(to) - get_constant(from);
-//
-//     value arr = new_array(size);
-//
-//     for (int i = 0; i < size; i++) {
-//         arr.data.array[i] = new_constant(get_constant(from) + i);
-//     }
-//
-//     return arr;
-// }
+// 0 até until, sem incluir
+value range(s24_vm* vm) 
+{
+    value until = pop(vm);
+    return new_range(vm, 0, 1, get_constant(until));
+}
 
-// todo: pra std
-// value range1() {
-//     value to = pop();
-//     int size = get_unit(to);
-//     value arr = new_array(size);
-//     array_iter(arr, i, new_constant(i))
-//     return arr;
-// }
+// from até until, sem incluir
+value range2(s24_vm* vm) 
+{
+    value until = pop(vm), from = pop(vm);
+    return new_range(vm, get_constant(from), 1, get_constant(until) - get_constant(from));
+}
+
+// amount cópias de fill. uma só é o próprio fill, como no $. de antes.
+value fill(s24_vm* vm) 
+{
+    value fill = pop(vm), amount = pop(vm);
+    double count = get_constant(amount);
+
+    if (type_of(fill) == constant && count > 1)
+        return new_range(vm, as_constant(fill), 0, count);
+    if (!(count > 0))
+    {
+        release(vm, fill);
+        return new_array(vm, 0);
+    }
+
+    int size = ceil(count);
+    region_mark m = mark_region(vm);
+    value* items = region_alloc(vm, sizeof(value) * size);
+    for (int i = 0; i < size; i++)
+        items[i] = retain(fill);
+    value r = gather(vm, items, size);
+    release_region(vm, m);
+    release(vm, fill);
+    return r;
+}
+
+value _index(s24_vm* vm) 
+{
+    value mask = pop(vm);
+
+    if (type_of(mask) == bits)
+    {
+        value arr = new_numbers(vm, count_bits(mask));
+        int j = 0;
+        for_each_bit(mask, i)
+            as_numbers(arr)[j++] = i;
+        release(vm, mask);
+        return arr;
+    }
+
+    int count = 0;
+    for (int i = 0; i < size_of(mask); i++) 
+        count += get_constant(array_at(vm, mask, i)) == 1.0;
+
+    value arr = new_array(vm, count);
+    for (int i = 0, j = 0; i < size_of(mask); i++) 
+        if (get_constant(array_at(vm, mask, i)) == 1.0) 
+            as_array(arr)[j++] = new_constant(i);
+
+    release(vm, mask);
+    return pack(vm, arr);
+}
+
+// os doubles de qualquer lista de constantes, na região quando não dá
+// pra usar o buffer direto
+double* constants_of(s24_vm* vm, value arr, int* size)
+{
+    double* x = numbers_of(vm, arr, size);
+    if (x != NULL)
+        return x;
+
+    *size = size_of(arr);
+    x = region_alloc(vm, sizeof(double) * *size);
+    for (int i = 0; i < *size; i++)
+        x[i] = get_constant(array_at(vm, arr, i));
+    return x;
+}
+
+unsigned int hash_number(double x)
+{
+    // -0 e 0 caem no mesmo lugar
+    uint64_t bits;
+    x += 0.0;
+    memcpy(&bits, &x, sizeof(bits));
+    return (bits * 0x9e3779b97f4a7c15ull) >> 32;
+}
+
+// índice de cada elemento de to_search em list, a primeira posição, ou -1.
+// list vira uma tabela de hash, com o mesmo esquema dos símbolos.
+value _index2(s24_vm* vm) 
+{
+    value to_search = pop(vm), list = pop(vm);
+
+    region_mark m = mark_region(vm);
+    int keys_size, list_size;
+    double* keys = constants_of(vm, to_search, &keys_size);
+    double* items = constants_of(vm, list, &list_size);
+
+    unsigned int slots_size = 16;
+    while (slots_size < 2u * list_size)
+        slots_size *= 2;
+    unsigned int mask = slots_size - 1;
+    int* slots = region_alloc(vm, sizeof(int) * slots_size);
+    memset(slots, 0, sizeof(int) * slots_size);
+
+    for (int j = 0; j < list_size; j++) 
+    {
+        unsigned int i = hash_number(items[j]) & mask;
+        while (slots[i] != 0 && items[slots[i] - 1] != items[j])
+            i = (i + 1) & mask;
+        if (slots[i] == 0)
+            slots[i] = j + 1;
+    }
+
+    value arr = keys_size > 0 ? new_numbers(vm, keys_size) : new_array(vm, 0);
+    for (int k = 0; k < keys_size; k++) 
+    {
+        unsigned int i = hash_number(keys[k]) & mask;
+        while (slots[i] != 0 && items[slots[i] - 1] != keys[k])
+            i = (i + 1) & mask;
+        as_numbers(arr)[k] = slots[i] - 1;
+    }
+
+    release_region(vm, m);
+    release(vm, to_search);
+    release(vm, list);
+    return arr;
+}
+
+value reverse(s24_vm* vm) 
+{
+    value arr = pop(vm);
+
+    assert(is_list(arr));
+
+    value new;
+    if ((type_of(arr) == numbers || type_of(arr) == view) && size_of(arr) > 0)
+    {
+        // só anda de trás pra frente no mesmo buffer
+        layout l = describe(arr);
+        l.data += (l.shape[0] - 1) * l.stride[0];
+        l.stride[0] = -l.stride[0];
+        new = new_view(vm, &l);
+    }
+    else if (type_of(arr) == bits)
+    {
+        // inverte as palavras inteiras e depois tira o que sobrou da última
+        int n = size_of(arr), words = word_count(n);
+        new = new_bits(vm, n);
+        for (int i = 0; i < words; i++)
+            as_words(new)[i] = reverse_word(as_words(arr)[words - i - 1]);
+        copy_bits(as_words(new), as_words(new), words * 64 - n, n);
+        trim_bits(new);
+    }
+    else {
+        new = new_array(vm, size_of(arr));
+        for (int i = 0; i < size_of(arr); i++){
+            as_array(new)[size_of(arr) - i - 1] = array_at(vm, arr, i);
+        }
+    }
+
+    release(vm, arr);
+    return new;
+}
+
+// matrizes que ainda são arrays de linhas viram uma view antes. tr e col
+// só fazem sentido com duas dimensões.
+layout matrix_layout(s24_vm* vm, value v, char* builtin)
+{
+    value matrix = type_of(v) == array ? stack_rows(vm, as_array(v), size_of(v)) : retain(v);
+    if (type_of(matrix) != view || as_layout(matrix)->rank != 2)
+    {
+        bail(vm);
+        fprintf(stderr, "error: %s expects a numeric matrix!\n", builtin);
+        print_pretty_value(vm, v, false);
+        fail(vm);
+    }
+
+    layout l = *as_layout(matrix);
+    retain(l.base);
+    release(vm, matrix);
+    return l;
+}
+
+value transpose(s24_vm* vm) 
+{
+    value arr = pop(vm);
+    // lista é a própria transposta, esteja num buffer ou numa view
+    if (type_of(arr) == numbers || (type_of(arr) == view && as_layout(arr)->rank == 1))
+        return arr;
+
+    layout l = matrix_layout(vm, arr, "tr");
+    int shape = l.shape[0], stride = l.stride[0];
+    l.shape[0] = l.shape[1], l.stride[0] = l.stride[1];
+    l.shape[1] = shape, l.stride[1] = stride;
+
+    value r = new_view(vm, &l);
+    release(vm, l.base);
+    release(vm, arr);
+    return r;
+}
+
+value column(s24_vm* vm) 
+{
+    value index = pop(vm), arr = pop(vm);
+    layout l = matrix_layout(vm, arr, "col");
+
+    int j = get_constant(index);
+    if (j < 0 || j >= l.shape[1])
+    {
+        bail(vm);
+        fprintf(stderr, "error: index out of bounds!\n");
+        fail(vm);
+    }
+
+    layout c = { .base = l.base, .data = l.data + j * l.stride[1], .rank = 1 };
+    c.shape[0] = l.shape[0], c.stride[0] = l.stride[0];
+
+    value r = new_view(vm, &c);
+    release(vm, l.base);
+    release(vm, arr);
+    return r;
+}
+
+// [from, to) do primeiro eixo. numbers e views não copiam nada, bits
+// continuam bits.
+value slice(s24_vm* vm) 
+{
+    value to_v = pop(vm), from_v = pop(vm), arr = pop(vm);
+    int from = get_constant(from_v), to = get_constant(to_v);
+
+    if (!is_array(arr) || from < 0 || from > to || to > size_of(arr))
+    {
+        bail(vm);
+        fprintf(stderr, "error: slice out of bounds!\n");
+        fail(vm);
+    }
+
+    value r;
+    if ((type_of(arr) == numbers || type_of(arr) == view) && to > from)
+    {
+        layout l = describe(arr);
+        l.data += from * l.stride[0];
+        l.shape[0] = to - from;
+        r = new_view(vm, &l);
+    }
+    else if (type_of(arr) == string)
+        r = string_from_bytes(vm, as_bytes(arr) + from, to - from);
+    else if (type_of(arr) == bits)
+    {
+        r = new_bits(vm, to - from);
+        copy_bits(as_words(r), as_words(arr), from, to - from);
+        trim_bits(r);
+    }
+    else {
+        r = new_array(vm, to - from);
+        for (int i = from; i < to; i++)
+            as_array(r)[i - from] = array_at(vm, arr, i);
+    }
+
+    release(vm, arr);
+    return r;
+}
+
+value at(s24_vm* vm) 
+{
+    value at = pop(vm), arr = pop_lazy(vm);
+    push(vm, arr), push(vm, at);
+
+    double index = get_constant(at);
+
+    if (index < 0 || index >= size_of(arr)) {
+        bail(vm);
+        fprintf(stderr, "error: index out of bounds!\n");
+        fail(vm);
+    }
+    if (fmodl(index, 1) != 0) {
+        bail(vm);
+        fprintf(
+            stderr,
+            "error: can't index array by floating point constant! "
+            "(index: %lf)\n", index);
+        print_pretty_value(vm, arr, false);
+        fail(vm);
+    }
+
+    return array_at(vm, arr, index);
+}
+
+// [ + ] rdl e parecidos sobre números dispensam execute(): o builtin
+// sozinho na nest é associativo, então o laço roda nativo
+double (*associative(value nested_op))(double, double)
+{
+    if (size_of(nested_op) != 1)
+        return NULL;
+
+    switch (as_nest(nested_op)[0].op)
+    {
+        case op_sum: return __sum_numeric;
+        case op_mul: return __mul_numeric;
+        case op_or:  return __or_numeric;
+        case op_and: return __and_numeric;
+        case op_min: return __min_numeric;
+        case op_max: return __max_numeric;
+        default:     return NULL;
+    }
+}
+
+// min e max não são associativos com NaN nem entre -0 e 0, então vão da
+// esquerda para a direita como o execute() faria, continuando de acc
+bool ordered(double (*numeric)(double,double))
+{
+    return numeric == __min_numeric || numeric == __max_numeric;
+}
+
+double fold_left(double acc, double* x, int n, double (*numeric)(double,double))
+{
+    for (int i = 0; i < n; i++)
+        acc = numeric(acc, x[i]);
+    return acc;
+}
+
+// em árvore, a metade da frente com a de trás pelo kernel até sobrar um.
+// a soma fica até mais precisa que da esquerda para a direita, mas pode
+// diferir dela na última casa. or e and dão exatamente o mesmo, o resultado
+// é sempre 0 ou 1.
+double fold_numbers(s24_vm* vm, double* x, int n, double (*numeric)(double,double))
+{
+    if (ordered(numeric))
+        return fold_left(x[0], x + 1, n - 1, numeric);
+
+    kernel k = find_kernel(numeric);
+    double* buf = region_alloc(vm, sizeof(double) * ((n + 1) / 2));
+    while (n > 1)
+    {
+        int half = n / 2, rest = n - half;
+        k(buf, x, x + rest, half, 1, 1);
+        if (rest > half)
+            buf[half] = x[half];
+        x = buf, n = rest;
+    }
+    return x[0];
+}
+
+// rdl sobre uma lazy ainda não calculada vai de pedaço em pedaço, sem
+// montar o array inteiro
+double fold_lazy(s24_vm* vm, value v, double (*numeric)(double,double))
+{
+    double buf[fuse_chunk], acc = 0;
+    for (int from = 0; from < size_of(v); from += fuse_chunk)
+    {
+        int n = size_of(v) - from < fuse_chunk ? size_of(v) - from : fuse_chunk;
+        run_chunk(as_deferred(v), from, n, buf);
+        if (ordered(numeric))
+        {
+            acc = from == 0 ? fold_left(buf[0], buf + 1, n - 1, numeric) 
+                : fold_left(acc, buf, n, numeric);
+            continue;
+        }
+        region_mark m = mark_region(vm);
+        double r = fold_numbers(vm, buf, n, numeric);
+        release_region(vm, m);
+        acc = from == 0 ? r : numeric(acc, r);
+    }
+    return acc;
+}
 
-value _index() 
+void reduce_left(s24_vm* vm) 
 {
-    value mask = pop();
+    value nested_op = pop(vm), arr = pop_lazy(vm);
+    double (*numeric)(double,double) = type_of(nested_op) == nest ? associative(nested_op) : NULL;
+    if (numeric != NULL && type_of(arr) == lazy && is_null(as_deferred(arr)->result))
+    {
+        push(vm, new_constant(fold_lazy(vm, arr, numeric)));
+        release(vm, arr);
+        return;
+    }
+    arr = force(vm, arr);
 
-    value arr = new_array(0);
-    for (int i = 0; i < mask.size; i++) 
+    if (type_of(nested_op) != nest) 
+    {
+        bail(vm);
+        fprintf(stderr, "error: can only apply nested operations to arrays!!\n");
+        print_pretty_value(vm, nested_op, false);
+        fail(vm);
+    }
+    if (!is_list(arr)) 
+    {
+        bail(vm);
+        fprintf(stderr, "error: can't reduce what's not an array!\n");
+        print_pretty_value(vm, arr, false);
+        fail(vm);
+    }
+
+    region_mark m = mark_region(vm);
+    int size;
+    double* x = numeric != NULL ? numbers_of(vm, arr, &size) : NULL;
+    if (x != NULL && size > 0)
     {
-
-        if (get_constant(array_at(mask, i)) == 1.0) 
-        {
-            array_append(&arr, new_constant(i));
-        }
+        push(vm, new_constant(fold_numbers(vm, x, size, numeric)));
+        release_region(vm, m);
+        release(vm, arr);
+        return;
     }
+    release_region(vm, m);
 
-    return arr;
+    keep(vm, &arr, 1);
+    push(vm, array_at(vm, arr, 0));
+    for (int i = 1; i < size_of(arr); i++) 
+    {
+        push(vm, array_at(vm, arr, i));
+        execute(vm, as_nest(nested_op), size_of(nested_op));
+    }
+    drop(vm, 1);
+    release(vm, arr);
 }
 
-value _index2() 
+value accumulate_left(s24_vm* vm) 
 {
-    value to_search = pop(), list = pop();
-
-    value arr = new_array(0);
+    value nested_op = pop(vm), arr = pop(vm);
 
-    for (int i = 0; i < to_search.size; i++) 
+    if (type_of(nested_op) != nest) 
     {
+        bail(vm);
+        fprintf(stderr, "error: can only apply nested operations to arrays!!\n");
+        print_pretty_value(vm, nested_op, false);
+        fail(vm);
+    }
+    if (!is_list(arr)) 
+    {
+        bail(vm);
+        fprintf(stderr, "error: can't reduce what's not an array!\n");
+        print_pretty_value(vm, arr, false);
+        fail(vm);
+    }
 
-        bool found = false;
-        for (int j = 0; j < list.size; j++)  {
-
-            if (get_constant(array_at(to_search, i)) == get_constant(array_at(list, j)))  {
-                array_append(&arr, new_constant(j));
-                found = true;
-                break;
-            }
-        }
-        if (!found)
-            array_append(&arr, new_constant(-1));
+    // a varredura é sequencial mesmo, e sai igual à do execute()
+    double (*numeric)(double,double) = associative(nested_op);
+    region_mark m = mark_region(vm);
+    int size;
+    double* x = numeric != NULL ? numbers_of(vm, arr, &size) : NULL;
+    if (x != NULL && size > 1)
+    {
+        value r = new_numbers(vm, size - 1);
+        double acc = x[0];
+        for (int i = 1; i < size; i++)
+            as_numbers(r)[i - 1] = acc = numeric(acc, x[i]);
+        release_region(vm, m);
+        release(vm, arr);
+        return r;
     }
+    release_region(vm, m);
 
-    return arr;
+    value acc = array_builder(vm, size_of(arr) > 0 ? size_of(arr) - 1 : 0);
+    keep(vm, &arr, 1);
+    keep(vm, &acc, 1);
+    push(vm, array_at(vm, arr, 0));
+    for (int i = 1; i < size_of(arr); i++) 
+    {
+        push(vm, array_at(vm, arr, i));
+        execute(vm, as_nest(nested_op), size_of(nested_op));
+        array_append(vm, &acc, retain(peek(vm)));
+    }
+    drop(vm, 2);
+    release(vm, pop(vm));
+    release(vm, arr);
+    return pack(vm, acc);
 }
 
-value reverse() 
-{
-    value arr = pop(), new = new_array(arr.size);
 
-    assert(arr.type == array);
 
-    for (int i = 0; i < arr.size; i++){
-        new.data.array[arr.size - i - 1] = array_at(arr, i);
-    }
 
-    return new;
-}
+// $. e $: sobre arrays grandes rodam em vários workers. cada um é uma vm
+// com pilha, região e heap próprios, que só lê os símbolos e os objetos da
+// vm que chamou. o que a nest imprime fica guardado por pedaço e sai na
+// ordem no fim.
+#define parallel_min_size 2048
+#define parallel_chunk 256
+#define max_workers 64
 
-value at() 
+// nest que chega pela pilha escapa daqui, essa o worker pega na hora
+bool assigns_globals(s24_vm* vm, instruction* code, int amount, int depth)
 {
-    value at = pop(), arr = pop();
-    push(arr), push(at);
+    if (depth > 8)
+        return true;
 
-    double index = get_constant(at);
+    for (int i = 0; i < amount; i++)
+    {
+        if (code[i].op == op_assign || code[i].op == op_assign_exec)
+            return true;
+        if (code[i].op != op_word)
+            continue;
 
-    if (index < 0 || index >= arr.size) {
-        fprintf(stderr, "error: index out of bounds!\n");
-        exit(1);
-    }
-    if (fmodl(index, 1) != 0) {
-        fprintf(
-            stderr,
-            "error: can't index array by floating point constant! "
-            "(index: %lf)\n", index);
-        print_pretty_value(arr, false);
-        exit(1);
+        symbol* var = &vm->symbols[code[i].token];
+        if (var->defined && type_of(var->data) == nest
+                && assigns_globals(vm, as_nest(var->data), size_of(var->data), depth + 1))
+            return true;
     }
+    return false;
+}
 
-    return array_at(arr, index);
+#ifndef __EMSCRIPTEN__
+
+typedef struct broadcast_job {
+    value a, b;
+    bool binary;
+    value* items;
+    int size, chunks;
+    int next; // próximo pedaço livre, quem termina antes pega mais
+    bool failed;
+    char** output;
+    size_t* output_size;
+} broadcast_job;
+
+typedef struct worker {
+    broadcast_job* job;
+    s24_vm* vm;
+} worker;
+
+// a pilha de quem chamou vem emprestada, para #n e ps verem o mesmo que
+// veriam em série
+s24_vm* new_worker(s24_vm* vm)
+{
+    s24_vm* w = calloc(1, sizeof(s24_vm));
+    memcpy(w->stack, vm->stack, sizeof(value) * vm->stack_size);
+    w->stack_size = w->stack_floor = vm->stack_size;
+    w->symbols = vm->symbols;
+    w->symbol_count = vm->symbol_count;
+    w->symbol_names = vm->symbol_names;
+    w->constants = vm->constants;
+    w->constant_count = vm->constant_count;
+    w->broadcast = vm->broadcast;
+    w->gc.threshold = SIZE_MAX; // o coletor só roda na vm dona
+    return w;
 }
 
-void reduce_left() 
+// os objetos que sobraram passam para a vm dona
+void join_worker(s24_vm* vm, s24_vm* w)
 {
-    value nested_op = pop(), arr = pop();
+    object* last = w->objects;
+    while (last != NULL && last->next != NULL)
+        last = last->next;
+    if (last != NULL)
+    {
+        last->next = vm->objects;
+        if (vm->objects != NULL)
+            vm->objects->prev = last;
+        vm->objects = w->objects;
+    }
+    count_heap(vm, w->gc.heap);
 
-    if (nested_op.type != nest) 
+    for (chunk* c = w->region, *prev; c != NULL; c = prev)
     {
-        fprintf(stderr, "error: can only apply nested operations to arrays!!\n");
-        print_pretty_value(nested_op, false);
-        exit(1);
+        prev = c->prev;
+        free(c);
     }
-    if (arr.type != array) 
+    free(w);
+}
+
+void* broadcast_worker(void* arg)
+{
+    worker* self = arg;
+    broadcast_job* job = self->job;
+    s24_vm* vm = self->vm;
+
+    jmp_buf bail;
+    if (setjmp(bail))
     {
-        fprintf(stderr, "error: can't reduce what's not an array!\n");
-        print_pretty_value(arr, false);
-        exit(1);
+        // o que ficou na pilha segura referências a objetos da dona
+        while (vm->stack_size > vm->stack_floor)
+            release(vm, vm->stack[--vm->stack_size]);
+        if (vm->out != NULL)
+            fclose(vm->out);
+        __atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+        return NULL;
     }
+    vm->bail = &bail;
 
-    push(array_at(arr, 0));
-    for (int i = 1; i < arr.size; i++) 
+    for (;;)
     {
-        push(array_at(arr, i));
-        execute(nested_op.data.nest, nested_op.size);
+        int c = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (c >= job->chunks || __atomic_load_n(&job->failed, __ATOMIC_RELAXED))
+            break;
+
+        vm->out = open_memstream(&job->output[c], &job->output_size[c]);
+        int end = (c + 1) * parallel_chunk < job->size ? (c + 1) * parallel_chunk : job->size;
+        for (int i = c * parallel_chunk; i < end; i++)
+        {
+            job->items[i] = job->binary
+                ? apply2_at(vm, _binary_broadcast, job->a, job->b, i)
+                : apply_at(vm, _unary_broadcast, job->a, i);
+            // em série o que sobrou ficaria na pilha de todo mundo
+            if (vm->stack_size != vm->stack_floor)
+                longjmp(bail, 1);
+        }
+        fclose(vm->out);
+        vm->out = NULL;
     }
+    return NULL;
 }
 
-value accumulate_left() 
+// preenche items[0..size) e devolve true, ou false sem efeito nenhum se não
+// valer a pena ou se a nest precisar rodar em série
+bool parallel_broadcast(s24_vm* vm, value* items, int size, value a, value b, bool binary)
 {
-    value nested_op = pop(), arr = pop();
+    if (vm->bail != NULL || size < parallel_min_size
+            || assigns_globals(vm, as_nest(vm->broadcast), size_of(vm->broadcast), 0))
+        return false;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int count = cpus < max_workers ? cpus : max_workers;
+    if (count < 2)
+        return false;
+
+    for (object* o = vm->objects; o != NULL; o = o->next)
+        o->shared = true;
+
+    int chunks = (size + parallel_chunk - 1) / parallel_chunk;
+    broadcast_job job = {
+        .a = a, .b = b, .binary = binary,
+        .items = items, .size = size, .chunks = chunks,
+        .output = calloc(chunks, sizeof(char*)),
+        .output_size = calloc(chunks, sizeof(size_t)),
+    };
 
-    if (nested_op.type != nest) 
-    {
-        fprintf(stderr, "error: can only apply nested operations to arrays!!\n");
-        print_pretty_value(nested_op, false);
-        exit(1);
-    }
-    if (arr.type != array) 
+    // esta thread é o worker 0
+    worker workers[max_workers];
+    pthread_t threads[max_workers];
+    int started = 1;
+    for (int i = 0; i < count; i++)
+        workers[i] = (worker) { &job, new_worker(vm) };
+    for (; started < count; started++)
+        if (pthread_create(&threads[started], NULL, broadcast_worker, &workers[started]) != 0)
+            break;
+    broadcast_worker(&workers[0]);
+    for (int i = 1; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    for (object* o = vm->objects; o != NULL; o = o->next)
+        o->shared = false;
+    for (int i = 0; i < count; i++)
+        join_worker(vm, workers[i].vm);
+
+    for (int c = 0; c < chunks; c++)
     {
-        fprintf(stderr, "error: can't reduce what's not an array!\n");
-        print_pretty_value(arr, false);
-        exit(1);
+        if (!job.failed && job.output[c] != NULL)
+            fwrite(job.output[c], 1, job.output_size[c], vm->out);
+        free(job.output[c]);
     }
+    free(job.output);
+    free(job.output_size);
 
-    value acc = new_array(0);
-    push(array_at(arr, 0));
-    for (int i = 1; i < arr.size; i++) 
+    if (job.failed)
     {
-        push(array_at(arr, i));
-        execute(nested_op.data.nest, nested_op.size);
-        array_append(&acc, peek());
+        for (int i = 0; i < size; i++)
+            release(vm, items[i]);
+        memset(items, 0, sizeof(value) * size);
     }
-    pop();
-    return acc;
+    return !job.failed;
 }
 
+#else
 
+bool parallel_broadcast(s24_vm* vm, value* items, int size, value a, value b, bool binary)
+{
+    return false;
+}
 
+#endif
 
-s24_nest broadcast;
-
-value _unary_broadcast(value v) {
+value _unary_broadcast(s24_vm* vm, value v) {
     if (is_array(v)) {
-        return unary_op(v, _unary_broadcast);
+        return unary_op(vm, v, _unary_broadcast);
     }
 
-    push(v);
-    execute(broadcast.data.nest, broadcast.size);
-    return pop();
+    push(vm, retain(v));
+    execute(vm, as_nest(vm->broadcast), size_of(vm->broadcast));
+    return pop(vm);
 }
 
-value _binary_broadcast(value a, value b) {
+value _binary_broadcast(s24_vm* vm, value a, value b) {
     if (is_array(a) || is_array(b)) {
-        return binary_op(a, b, _binary_broadcast);
+        return binary_op(vm, a, b, _binary_broadcast, NULL);
     }
 
-    push(a);
-    push(b);
-    execute(broadcast.data.nest, broadcast.size);
-    return pop();
+    push(vm, retain(a));
+    push(vm, retain(b));
+    execute(vm, as_nest(vm->broadcast), size_of(vm->broadcast));
+    return pop(vm);
 }
 
-value binary_broadcast() {
-    broadcast = pop();
-    if (broadcast.type != nest) {
+// a nest de fora volta no fim, um $. dentro de outro não atropela o de fora
+value binary_broadcast(s24_vm* vm) {
+    value outer = vm->broadcast;
+    vm->broadcast = pop(vm);
+    if (type_of(vm->broadcast) != nest) {
+        bail(vm);
         fprintf(stderr, "error: broadcast operation must be nested\n");
-        exit(1);
+        fail(vm);
     }
-    return binary_op(pop(), pop(), _binary_broadcast);
+    value r = binary_builtin(vm, _binary_broadcast, NULL);
+    vm->broadcast = outer;
+    return r;
 }
 
-value unary_broadcast() {
-    broadcast = pop();
-    if (broadcast.type != nest) {
+value unary_broadcast(s24_vm* vm) {
+    value outer = vm->broadcast;
+    vm->broadcast = pop(vm);
+    if (type_of(vm->broadcast) != nest) {
+        bail(vm);
         fprintf(stderr, "error: broadcast operation must be nested\n");
-        exit(1);
+        fail(vm);
     }
-    return unary_op(pop(), _unary_broadcast);
+    value r = unary_builtin(vm, _unary_broadcast);
+    vm->broadcast = outer;
+    return r;
 }
 
 
 
 
 
-void execute(char* start, int amount) 
-{
-    char* last;
-    int parens;
-
-rewind:
-    last = start + amount*token_stride;
-    parens = 0;
+// --------------------------- //
+// ----     compiler     ----- //
+// --------------------------- //
 
-    for (char* current = start; current < last; current += token_stride) 
-    {
+struct builtin {
+    char* name;
+    opcode op;
+} builtins[] = {
+    { "pop",  op_pop },
+    { "+",    op_sum },
+    { "-",    op_sub },
+    { "*",    op_mul },
+    { "/",    op_div },
+    { "not",  op_not },
+    { "=",    op_equal },
+    { "or",   op_or },
+    { "and",  op_and },
+    { "min",  op_min },
+    { "max",  op_max },
+    { "->",   op_assign },
+    { "!->",  op_assign_exec },
+    { "?",    op_branch },
+    { "do",   op_do },
+    { "over", op_over },
+    { ";",    op_end },
+    { "#",    op_size },
+    { "at",   op_at },
+    { "abs",  op_abs },
+    { "pp",   op_pp },
+    { "nl",   op_nl },
+    { "fmt",  op_fmt },
+    { "ps",   op_ps },
+    { "pv",   op_pv },
+    { "idx",  op_idx },
+    { "idx2", op_idx2 },
+    { "dup",  op_dup },
+    { "mod",  op_mod },
+    { "a",    op_list },
+    { "**",   op_pow },
+    { "rou",  op_round },
+    { "msk",  op_mask },
+    { "rdl",  op_rdl },
+    { "acc",  op_acc },
+    { "rev",  op_rev },
+    { "clr",  op_clr },
+    { "ipr",  op_ipr },
+    { "x",    op_x },
+    { "rx",   op_rx },
+    { "unb",  op_unb },
+    { "ld",   op_ld },
+    { "sws",  op_sws },
+    { "ss",   op_ss },
+    { "a2n",  op_a2n },
+    { ">0",   op_gt0 },
+    { "<0",   op_lt0 },
+    { "$:",   op_binary_broadcast },
+    { "$.",   op_unary_broadcast },
+    { "cos",  op_cos },
+    { "sin",  op_sin },
+    { "exp",  op_exp },
+    { "log",  op_log },
+    { "sqrt", op_sqrt },
+    { "tr",   op_tr },
+    { "col",  op_col },
+    { "slc",  op_slc },
+    { "fac",  op_fac },
+    { "ran",  op_ran },
+    { "ran2", op_ran2 },
+    { "fll",  op_fll },
+};
 
+opcode find_builtin(char* token)
+{
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++)
+        if (strcmp(token, builtins[i].name) == 0)
+            return builtins[i].op;
+    return op_word;
+}
 
-        if (strcmp(current, "((" /*))*/) == 0 || strcmp(current, /*((*/"))") == 0) 
-        {
-            continue;
-        }
+instruction* find_label(s24_vm* vm, instruction* start, instruction* last, instruction* label)
+{
+    if (strlen(symbol_name(vm, label->token)) == 1)
+    {
+        fprintf(stderr, "error: goto label \"%s\" is not a label!\n", symbol_name(vm, label->token));
+        fail(vm);
+    }
 
-        if (strcmp(current, "(" /*)*/) == 0) 
-        {
-            parens++;
-            continue;
-        }
-        if (strcmp(current,  /*(*/")") == 0) 
-        {
-            if (parens == 0) 
-            {
-                fprintf(stderr, "error: parens mismatch!\n");
-                exit(1);
-            }
-            parens--;
-            continue;
-        }
-        if (parens > 0) 
+    for (instruction* i = start; i < last; i++)
+    {
+        if (i->op != op_label)
             continue;
+        if (i != label && i->token == label->token)
+            return i;
+    }
 
-        if (parens < 0) 
-        {
-            fprintf(stderr, "error: parens mismatch!\n");
-            exit(1);
-        }
+    fprintf(stderr, "error: couldn't find label \"%s\"!\n", symbol_name(vm, label->token));
+    fail(vm);
+}
 
-        if (*current == '"') 
+// cada nest só enxerga o próprio pedaço, o mesmo que execute() recebe, então
+// os destinos são resolvidos escopo por escopo.
+void resolve_jumps(s24_vm* vm, instruction* start, instruction* last)
+{
+    for (instruction* current = start; current < last; current++)
+    {
+        switch (current->op)
         {
+            case op_nest:
+                if (current->jump > 0)
+                {
+                    resolve_jumps(vm, current + 1, current + current->jump);
+                    current += current->jump;
+                }
+                break;
 
-            value string = new_string(0);
-
-            char* i = current + 1;
-            char* t = current;
+            case op_branch:
+                // jump: se verdadeiro, arg: se falso. sem label pula um token
+                current->jump = current->arg = 1;
+                if (current + 1 < last && current[1].op == op_label)
+                    current->jump = find_label(vm, start, last, current + 1) - current;
+                if (current + 2 < last && current[2].op == op_label)
+                    current->arg = find_label(vm, start, last, current + 2) - current;
+                break;
 
-            for (; i < last; i++) 
+            case op_do:
             {
-                if (*i == '\0' || (*i == '\\' && *(i+1) == '\0'))
-                {
-                    array_append(&string, new_character(' '));
-                    t += token_stride;
-                    i = t-1;
-                }
-                else if (*i == '"')
-                {
-                    assert(i == t + strlen(t) - 1);
-                    break;
+                instruction* i = current + 1;
+                int level = 1;
+                for (; i < last; i++) {
+                    if (i->op == op_do)
+                        level++;
+                    if (i->op == op_over)
+                        level--;
+                    if (level == 0)
+                        break;
                 }
-                else {
-                    array_append(&string, new_character(*i));
+                if (level > 0) {
+                    fprintf(stderr, "error: loop without over\n");
+                    fail(vm);
                 }
+                current->jump = i - current;
+                break;
             }
 
-            push(string);
-            current = t;
-            continue;
-        }
-
-        if (strcmp(current, "[" /*]*/) == 0) 
-        {
-            value new_nest = (value) { 
-                .type = nest,
-                .data.nest = NULL,
-                .size = 0,
-            };
-            int brackets = 1;
-            char* i = current + token_stride;
-            for (; i < last; i += max_token_len) 
+            case op_over:
             {
-                if (strcmp(i, "[" /*]*/ ) == 0) 
-                {
-                    brackets++;
+                int level = 1;
+                instruction* i = current - 1;
+                for (; i >= start ; i--) {
+                    if (i->op == op_over)
+                        level++;
+                    if (i->op == op_loop)
+                        level--;
+                    if (level == 0)
+                        break;
                 }
-                if (strcmp(i, /*[*/ "]") == 0) 
-                {
-                    brackets--;
+                if (level > 0) {
+                    fprintf(stderr, "error: over without loop\n");
+                    fail(vm);
                 }
-                if (brackets == 0)
-                    break;
-
-                new_nest.data.nest = realloc(new_nest.data.nest , max_token_len * ++new_nest.size);
-                strcpy(new_nest.data.nest + (new_nest.size-1)*token_stride, i);
+                current->jump = i - current;
+                break;
             }
-            if (i == last) 
+
+            case op_end:
             {
-                fprintf(stderr, "error: unmatched nesting!\n");
-                exit(1);
+                instruction* i = current;
+                for (; i < last; i++)
+                    if (i->op == op_label && strcmp(symbol_name(vm, i->token), ".end") == 0)
+                        break;
+
+                if (i == last)
+                {
+                    fprintf(stderr, "error: couldn't find .end label!\n");
+                    fail(vm);
+                }
+                current->jump = i - current;
+                break;
             }
 
-            current = i;
+            default:
+                break;
+        }
+    }
+}
 
-            push(new_nest);
-            continue;
+int add_constant(s24_vm* vm, value v)
+{
+    if (vm->constant_count >= vm->constant_capacity)
+    {
+        vm->constant_capacity = vm->constant_capacity == 0 ? 256 : vm->constant_capacity * 2;
+        vm->constants = realloc(vm->constants, sizeof(value) * vm->constant_capacity);
+    }
+    vm->constants[vm->constant_count] = v;
+    return vm->constant_count++;
+}
+
+value string_literal(s24_vm* vm, int* tokens, int span)
+{
+    int len = 0;
+    for (int j = 0; j < span; j++)
+        len += strlen(symbol_name(vm, tokens[j])) + 1;
+
+    region_mark m = mark_region(vm);
+    char* builder = region_alloc(vm, len + 1);
+    char* b = builder;
+
+    for (int j = 0; j < span; j++)
+    {
+        char* i = symbol_name(vm, tokens[j]) + (j == 0);
+        for (; *i != '\0' && *i != '"'; i++)
+        {
+            if (*i == '\\' && *(i+1) == '\0')
+                break;
+            *b++ = *i;
+        }
+        if (*i == '"')
+        {
+            assert(*(i+1) == '\0');
+            break;
         }
+        *b++ = ' ';
+    }
+    *b = '\0';
 
+    value string = from_string(vm, builder);
+    release_region(vm, m);
+    return string;
+}
 
-        double number;
-        if (sscanf(current, "%lf", &number) == 1) 
+// traduz os tokens uma única vez, antes de executar. a ordem dos testes é a
+// mesma que execute() fazia token por token.
+instruction* compile(s24_vm* vm, int* tokens, int amount)
+{
+    instruction* code = malloc(sizeof(instruction) * amount);
+    int parens = 0;
+
+    int* brackets = malloc(sizeof(int) * amount);
+    int bracket_depth = 0;
+
+    for (int i = 0; i < amount; i++)
+    {
+        char* current = symbol_name(vm, tokens[i]);
+        code[i] = (instruction) { .op = op_nop, .arg = 0, .token = tokens[i] };
+
+        if (strcmp(current, "((" /*))*/) == 0 || strcmp(current, /*((*/"))") == 0)
+            continue;
+
+        if (strcmp(current, "(" /*)*/) == 0)
         {
-            push(new_constant(number));
+            parens++;
             continue;
         }
-
-        if (current[0] == '.' || strcmp(current, "loop") == 0) 
+        if (strcmp(current,  /*(*/")") == 0)
         {
+            if (parens == 0)
+                code[i].op = op_paren_close;
+            else
+                parens--;
             continue;
         }
+        if (parens > 0)
+            continue;
 
-
-        if (strcmp(current, "pop") == 0)
+        if (*current == '"')
         {
-            pop();
+            // strings podem ocupar vários tokens
+            int span = 1;
+            char* t = current + 1;
+            while (strchr(t, '"') == NULL && i + span < amount)
+                t = symbol_name(vm, tokens[i + span++]);
+
+            code[i].op = op_string;
+            code[i].arg = add_constant(vm, string_literal(vm, tokens + i, span));
+            code[i].jump = span - 1;
+            for (int j = 1; j < span; j++)
+                code[i+j] = (instruction) { .op = op_nop, .token = tokens[i+j] };
+            i += span - 1;
+            continue;
         }
 
-        else if (strcmp(current, "+") == 0)
+        if (strcmp(current, "[" /*]*/) == 0)
         {
-            push(sum());
+            code[i].op = op_nest;
+            brackets[bracket_depth++] = i;
+            continue;
         }
-
-        else if (strcmp(current, "-") == 0)
+        if (strcmp(current, /*[*/ "]") == 0)
         {
-            push(subtraction());
+            code[i].op = op_nest_end;
+            if (bracket_depth > 0)
+            {
+                // [ guarda a distância até o seu ]
+                int open = brackets[--bracket_depth];
+                code[open].jump = i - open;
+            }
+            continue;
         }
 
-        else if (strcmp(current, "*") == 0)
+        double number;
+        if (sscanf(current, "%lf", &number) == 1)
         {
-            push(multiplication());
+            code[i].op = op_constant;
+            code[i].arg = add_constant(vm, new_constant(number));
+            continue;
         }
 
-        else if (strcmp(current, "/") == 0)
+        if (current[0] == '.')
         {
-            push(division());
+            code[i].op = op_label;
+            continue;
         }
-
-        else if (strcmp(current, "not") == 0)
+        if (strcmp(current, "loop") == 0)
         {
-            push(not());
+            code[i].op = op_loop;
+            continue;
         }
 
-        else if (strcmp(current, "=") == 0)
+        code[i].op = find_builtin(current);
+
+        if (code[i].op == op_assign || code[i].op == op_assign_exec)
         {
-            push(equal());
+            if (i + 1 >= amount)
+            {
+                fprintf(stderr, "error: missing variable name after \"%s\"!\n", current);
+                fail(vm);
+            }
+            i++;
+            code[i] = (instruction) { .op = op_nop, .token = tokens[i] };
+            code[i-1].arg = tokens[i];
         }
 
-        else if (strcmp(current, "or") == 0)
+        else if (code[i].op == op_word && strlen(current) > 1 && current[0] == '#')
         {
-            push(or());
+            if (sscanf(current+1, "%d", &code[i].arg) == 0){
+                fprintf(stderr, "error: failed parsing number (%s)!\n", current+1);
+                fail(vm);
+            };
+            code[i].op = op_pick;
         }
+    }
+
+    free(brackets);
+    resolve_jumps(vm, code, code + amount);
+    return code;
+}
+
+void execute(s24_vm* vm, instruction* start, int amount)
+{
+    instruction* last;
 
-        else if (strcmp(current, "->")  == 0 || strcmp(current, "!->")  == 0)
+rewind:
+    last = start + amount;
+
+    for (instruction* current = start; current < last; current++)
+    {
+        if (vm->gc.heap > vm->gc.threshold)
+            collect(vm);
+
+        switch (current->op)
         {
-            value assign = pop(), var;
+            case op_nop:
+            case op_label:
+            case op_loop:
+                break;
+
+            case op_paren_close:
+                bail(vm);
+                fprintf(stderr, "error: parens mismatch!\n");
+                fail(vm);
 
-            char* name = current + token_stride;
-            int idx;
+            case op_string:
+                push(vm, retain(vm->constants[current->arg]));
+                current += current->jump;
+                break;
 
-            if ((idx = find_var(name)) >= 0)
+            case op_nest:
             {
-                // free_value(var_data[idx]); // problemático
-            }
-            else {
-                idx = var_count++;
+                if (current->jump == 0 || current + current->jump >= last)
+                {
+                    bail(vm);
+                    fprintf(stderr, "error: unmatched nesting!\n");
+                    fail(vm);
+                }
+
+                push(vm, new_nest(current));
+                current += current->jump;
+                break;
             }
 
-            if (current[0] == '!')
-                assign.auto_exec = true;
+            case op_constant:
+                push(vm, vm->constants[current->arg]);
+                break;
 
-            var_names[idx] = name;
-            var_data[idx] = assign;
-            current = name; // proxima iteração pula o nome da variável
-        }
+            case op_pop:
+                release(vm, pop(vm));
+                break;
 
-        else if (strcmp(current, "?") == 0)
-        {
-            value check = pop();
+            case op_sum:
+                push(vm, sum(vm));
+                break;
 
-            if (get_constant(check)) 
-            {
-                char* goto_label = current += token_stride;
+            case op_sub:
+                push(vm, subtraction(vm));
+                break;
 
-                if (goto_label[0] != '.')
-                    continue;
+            case op_mul:
+                push(vm, multiplication(vm));
+                break;
 
-                if (goto_label[0] == '.' && strlen(goto_label) == 1) 
-                {
-                    fprintf(stderr, "error: goto label \"%s\" is not a label!\n", goto_label);
-                    exit(1);
-                }
+            case op_div:
+                push(vm, division(vm));
+                break;
 
-                for (char* i = start; i < last; i += token_stride) 
-                {
-                    if (i[0] != '.')
-                        continue;
-                    if (i != goto_label && strcmp(goto_label, i) == 0) 
-                    {
-                        current = i;
-                        goto force_continue;
-                    }
-                }
+            case op_not:
+                push(vm, not(vm));
+                break;
 
-                fprintf(stderr, "error: couldn't find label \"%s\"!\n", goto_label);
-                exit(1);
-            }
-            else {
-                char* else_label = current + token_stride*2;
+            case op_equal:
+                push(vm, equal(vm));
+                break;
 
-                if (else_label[0] != '.') 
-                {
-                    current += token_stride;
-                    continue;
-                }
+            case op_or:
+                push(vm, or(vm));
+                break;
 
-                if (else_label[0] == '.' && strlen(else_label) == 1) 
-                {
-                    fprintf(stderr, "error: goto label \"%s\" is not a label!\n", else_label);
-                    exit(1);
-                }
+            case op_and:
+                push(vm, and(vm));
+                break;
 
-                for (char* i = start; i < last; i += token_stride) 
-                {
-                    if (i[0] != '.')
-                        continue;
-                    if (i != else_label && strcmp(else_label, i) == 0) 
-                    {
-                        current = i;
-                        goto force_continue;
-                    }
-                }
+            case op_min:
+                push(vm, _min(vm));
+                break;
+
+            case op_max:
+                push(vm, _max(vm));
+                break;
 
-                fprintf(stderr, "error: couldn't find label \"%s\"!\n", else_label);
-                exit(1);
+            case op_assign:
+            case op_assign_exec:
+            {
+                // um worker não pode mexer nas variáveis de todo mundo
+                bail(vm);
+
+                value assign = pop_lazy(vm);
+                if (!is_range(assign))
+                    assign = force(vm, assign);
+                symbol* var = &vm->symbols[current->arg];
+
+                if (var->defined)
+                    release(vm, var->data);
+
+                var->data = assign;
+                var->auto_exec = current->op == op_assign_exec;
+                var->defined = true;
+                current++; // proxima iteração pula o nome da variável
+                break;
             }
-        }
 
-        else if (strcmp(current, "loop") == 0)
-        {
-            continue;
-        }
+            case op_branch:
+                current += get_constant(pop(vm)) ? current->jump : current->arg;
+                break;
+
+            case op_do:
+                if (!get_constant(pop(vm)))
+                    current += current->jump;
+                break;
 
-        else if (strcmp(current, "do") == 0)
-        {
-            if (get_constant(pop())) {
-                continue;
-            }
-            else {
-                char* i = current + token_stride;
-                int level = 1;
-                for (; i < last; i += token_stride) {
-                    if (strcmp(i, "do") == 0)
-                        level++;
-                    if (strcmp(i, "over") == 0)
-                        level--;
-                    if (level == 0)
-                        break;
-                }
-                if (level > 0) {
-                    fprintf(stderr, "error: loop without over\n");
-                    exit(1);
-                }
-                current = i;
-            }
-        }
+            case op_over:
+            case op_end:
+                current += current->jump;
+                break;
 
-        else if (strcmp(current, "over") == 0)
-        {
-            int level = 1;
-            char* i = current - token_stride;
-            for (; i >= start ; i -= token_stride) {
-                if (strcmp(i, "over") == 0)
-                    level++;
-                if (strcmp(i, "loop") == 0)
-                    level--;
-                if (level == 0)
-                    break;
-            }
-            if (level > 0) {
-                fprintf(stderr, "error: over without loop\n");
-                exit(1);
-            }
-            current = i;
-        }
+            case op_pick:
+                push(vm, retain(vm->stack[vm->stack_size - current->arg - 1]));
+                break;
 
-        else if (strcmp(current, ";") == 0) 
-        {
-            for (char* i = current; i < last; i += token_stride) 
+            case op_size:
             {
-                // printf("op: %s cmp: %d\n", i, strcmp(i, ".end"));
-                if (strcmp(i, ".end") == 0) 
-                {
-                    current = i;
-                    goto force_continue;
-                }
+                value p = peek_lazy(vm);
+                push(vm, new_constant(is_array(p) || type_of(p) == nest ? size_of(p) : 1));
+                break;
             }
-            fprintf(stderr, "error: couldn't find .end label!\n");
-            exit(1);
-        }
 
-        else if (strlen(current) > 1 && current[0] == '#')
-        {
-            int number;
-            if (sscanf(current+1, "%d", &number) == 0){
-                fprintf(stderr, "error: failed parsing number (%s)!\n", current+1);
-                exit(1);
-            };
-            push(stack[stack_size - number - 1]);
-
-        }
+            case op_at:
+                push(vm, at(vm));
+                break;
 
-        else if (strcmp(current, "#") == 0)
-        {
-            value p = peek();
-            push(new_constant(is_array(p) || p.type == nest ? p.size : 1));
-        }
+            case op_abs:
+                push(vm, _abs(vm));
+                break;
 
-        else if (strcmp(current, "at") == 0)
-        {
-            push(at());
-        }
+            case op_pp:
+                print_pretty_value(vm, peek(vm), false);
+                break;
 
-        else if (strcmp(current, "abs") == 0)
-        {
-            push(_abs());
-        }
+            case op_nl:
+                fprintf(vm->out, "\n");
+                break;
 
-        else if (strcmp(current, "pp")  == 0) 
-        {
-            print_pretty_value(peek(), false);
-        }
+            case op_fmt:
+            {
+                value string = pop(vm);
+                print_pretty_value(vm, string, false);
+                release(vm, string);
+                break;
+            }
 
-        else if (strcmp(current, "nl")  == 0) 
-        {
-            printf("\n");
-        }
+            case op_ps:
+                print_stack(vm);
+                break;
 
-        else if (strcmp(current, "fmt")  == 0) 
-        {
-            value string = pop();
-            print_pretty_value(string, false);
-        }
+            case op_pv:
+                print_vars(vm);
+                break;
 
-        else if (strcmp(current, "ps")  == 0) 
-        {
-            print_stack();
-        }
+            case op_idx:
+                push(vm, _index(vm));
+                break;
 
-        else if (strcmp(current, "pv")  == 0) 
-        {
-            print_vars();
-        }
+            case op_idx2:
+                push(vm, _index2(vm));
+                break;
 
-        else if (strcmp(current, "idx")  == 0) 
-        {
-            push(_index());
-        }
+            case op_dup:
+                push(vm, retain(peek_lazy(vm)));
+                break;
 
-        else if (strcmp(current, "idx2")  == 0) 
-        {
-            push(_index2());
-        }
+            case op_mod:
+                push(vm, mod(vm));
+                break;
 
-        else if (strcmp(current, "dup") == 0) 
-        {
-            push(copy(peek()));
-        }
+            case op_list:
+                push(vm, list(vm));
+                break;
 
-        else if (strcmp(current, "mod") == 0)
-        {
-            push(mod());
-        }
+            case op_pow:
+                push(vm, power(vm));
+                break;
 
-        else if (strcmp(current, "a")   == 0)
-        {
-            push(list());
-        }
+            case op_round:
+                push(vm, _round(vm));
+                break;
 
-        // else if (strcmp(current, "++")   == 0)
-        // {
-        //     push(new_unit(1));
-        //     push(sum());
-        // }
-        //
-        // else if (strcmp(current, "--")   == 0)
-        // {
-        //     push(new_unit(-1));
-        //     push(sum());
-        // }
-
-        else if (strcmp(current, "**")   == 0)
-        {
-            push(power());
-        }
+            case op_mask:
+                push(vm, mask(vm));
+                break;
 
-        else if (strcmp(current, "rou") == 0)
-        {
-            push(_round());
-        }
+            case op_rdl:
+                reduce_left(vm);
+                break;
 
-        else if (strcmp(current, "msk") == 0)
-        {
-            push(mask());
-        }
+            case op_acc:
+                push(vm, accumulate_left(vm));
+                break;
 
-        else if (strcmp(current, "rdl")  == 0) 
-        {
-            reduce_left();
-        }
+            case op_rev:
+                push(vm, reverse(vm));
+                break;
 
-        else if (strcmp(current, "acc")  == 0) 
-        {
-            push(accumulate_left());
-        }
+            case op_clr:
+                clear(vm);
+                break;
 
-        else if (strcmp(current, "rev") == 0)
-        {
-            push(reverse());
-        }
+            case op_ipr:
+                push(vm, is_prime(vm));
+                break;
 
-        else if (strcmp(current, "clr") == 0)
-        {
-            clear();
-        }
+            case op_fac:
+                push(vm, factor(vm));
+                break;
 
-        else if (strcmp(current, "ipr") == 0)
-        {
-            push(is_prime());
-        }
+            case op_ran:
+                push(vm, range(vm));
+                break;
 
-        // else if (strcmp(current, "ran") == 0)
-        // {
-        //     push(range());
-        // }
+            case op_ran2:
+                push(vm, range2(vm));
+                break;
 
-        // else if (strcmp(current, "ran1") == 0)
-        // {
-        //     push(range1());
-        // }
+            case op_fll:
+                push(vm, fill(vm));
+                break;
 
-        else if (strcmp(current, "x") == 0)
-        {
-            value nesting = pop();
-            if (nesting.type != nest) 
+            case op_x:
             {
-                fprintf(stderr, "error: can't execute what is not a nest!\n");
-                print_pretty_value(nesting, false);
-                exit(1);
+                value nesting = pop(vm);
+                if (type_of(nesting) != nest)
+                {
+                    bail(vm);
+                    fprintf(stderr, "error: can't execute what is not a nest!\n");
+                    print_pretty_value(vm, nesting, false);
+                    fail(vm);
+                }
+                execute(vm, as_nest(nesting), size_of(nesting));
+                break;
             }
-            execute(nesting.data.nest, nesting.size);
-        }
 
-        else if (strcmp(current, "rx") == 0)
-        {
-            value nesting = pop();
-            if (nesting.type != nest) 
+            case op_rx:
             {
-                fprintf(stderr, "error: can't execute what is not a nest!\n");
-                print_pretty_value(nesting,false );
-                exit(1);
-            }
+                value nesting = pop(vm);
+                if (type_of(nesting) != nest)
+                {
+                    bail(vm);
+                    fprintf(stderr, "error: can't execute what is not a nest!\n");
+                    print_pretty_value(vm, nesting,false );
+                    fail(vm);
+                }
 
-            if (nesting.data.nest != start) 
-            {
-                fprintf(stderr, "error: can't rewind a nest outside of itself! "
-                        "try using the 'x' command!\n");
-                print_pretty_value(nesting, false);
-                exit(1);
-            }
-            // execute(nesting.data.nest, nesting.size);
+                if (as_nest(nesting) != start)
+                {
+                    bail(vm);
+                    fprintf(stderr, "error: can't rewind a nest outside of itself! "
+                            "try using the 'x' command!\n");
+                    print_pretty_value(vm, nesting, false);
+                    fail(vm);
+                }
 
-            start = nesting.data.nest;
-            amount = nesting.size;
-            goto rewind;
-        }
+                start = as_nest(nesting);
+                amount = size_of(nesting);
+                goto rewind;
+            }
 
-        else if (strcmp(current, "unb") == 0) // inutil?
-        {
-            value arr = pop();
-            if (!is_array(arr)) 
+            case op_unb: // inutil?
             {
-                push(arr);
-                continue;
+                value arr = pop(vm);
+                if (!is_array(arr))
+                {
+                    push(vm, arr);
+                    break;
+                }
+                for (int i = 0; i < size_of(arr); i++)
+                {
+                    push(vm, array_at(vm, arr, i));
+                }
+                release(vm, arr);
+                break;
             }
-            for (int i = 0; i < arr.size; i++) 
+
+            case op_ld:
             {
-                push(array_at(arr, i));
-            }
-        }
+                value arg = pop(vm);
+                value first = is_string(arg) ? retain(arg) : array_at(vm, arg, 0); // fixme
+                value path = to_string(vm, first);
+                release(vm, first);
 
-        else if (strcmp(current, "ld") == 0)
-        {
-            value string = pop();
+                char* file;
+                int file_size = read_file_to_string(vm, as_bytes(path), &file);
+                release(vm, path);
+                release(vm, arg);
 
-            string = array_at(string, 0); // fixme
+                push(vm, box_object(string, file, file_size));
+                break;
+            }
 
-            char* builder = malloc(sizeof(char) * string.size + 1);
-            for (int i = 0; i < string.size; i++) 
+            case op_sws:
             {
-                builder[i] = array_at(string, i).data.c;
-            }
-            builder[string.size] = '\0';
+                value arg = pop(vm);
+                value string = to_string(vm, arg);
 
-            char* file;
-            int file_size = read_file_to_string(builder, &file);
+                value r = new_array(vm, 0);
+                int word = 0;
 
-            value new_string = new_array(0);
+                for (int i = 0; i <= size_of(string); i++)
+                {
+                    switch (i < size_of(string) ? as_bytes(string)[i] : ' ')
+                    {
+                        case ' ':
+                        case '\n':
+                        case '\t':
+                            if (i > word)
+                                array_append(vm, &r, string_from_bytes(vm, as_bytes(string) + word, i - word));
+                            word = i + 1;
+                            break;
+                        default:
+                            break;
+                    }
+                }
 
-            for (int i = 0; i < file_size; i++) 
-            {
-                array_append(&new_string, new_character(file[i]));
+                release(vm, string);
+                release(vm, arg);
+                push(vm, r);
+                break;
             }
 
-            push(new_string);
-        }
+            case op_ss:
+            {
+                value delimiter_arg = pop(vm);
+                value delimiter = to_string(vm, delimiter_arg);
 
-        else if (strcmp(current, "sws") == 0)
-        {
-            value string = pop();
+                value arg = pop(vm);
+                value first = is_string(arg) ? retain(arg) : array_at(vm, arg, 0); // fixme
+                value string = to_string(vm, first);
+                release(vm, first);
 
-            value r = new_array(0);
-            value b = new_array(0);
+                value r = new_array(vm, 0);
+                int piece = 0;
 
-            for (int i = 0; i < string.size; i++) 
-            {
-                value at = array_at(string, i);
-                switch (at.data.c) 
+                for (int i = 0; i <= size_of(string); i++)
                 {
-                    case ' ':
-                    case '\n':
-                    case '\t':
-                        if (b.size > 0)  {
-                            array_append(&r, b);
-                            b = new_array(0);
-                        }
-                        break;
-                    default:
-                        array_append(&b, at);
-                        break;
-                }
-            }
-            if (b.size > 0)
-                array_append(&r, b);
+                    bool at_end = i == size_of(string);
+                    bool at_delimiter = !at_end 
+                        && size_of(delimiter) > 0
+                        && i + size_of(delimiter) <= size_of(string)
+                        && memcmp(as_bytes(string) + i, as_bytes(delimiter), size_of(delimiter)) == 0;
 
-            push(r);
-        }
+                    if (!at_end && !at_delimiter)
+                        continue;
 
-        else if (strcmp(current, "ss") == 0)
-        {
-            char* delimiter = get_string(pop());
+                    if (i > piece)
+                        array_append(vm, &r, string_from_bytes(vm, as_bytes(string) + piece, i - piece));
 
-            value string = pop();
-            string = array_at(string, 0);
+                    if (at_delimiter)
+                        i += size_of(delimiter) - 1;
+                    piece = i + 1;
+                }
 
-            int delimiter_len = strlen(delimiter);
-            value r = new_array(0);
-            value b = new_array(0);
+                release(vm, delimiter);
+                release(vm, delimiter_arg);
+                release(vm, string);
+                release(vm, arg);
+                push(vm, r);
+                break;
+            }
 
-            for (int i = 0; i < string.size; i++) 
+            case op_a2n:
             {
-                char* s = get_string_slice(string, i, i+delimiter_len);
-                if (strcmp(s, delimiter) == 0) 
+                value arr = pop(vm);
+                if (is_string(arr))
+                    arr = wrap_array(vm, arr);
+
+                value r = new_numbers(vm, size_of(arr));
+
+                for (int i = 0; i < size_of(arr); i++)
                 {
 
+                    double number;
+                    value x = array_at(vm, arr, i);
+                    value s = to_string(vm, x);
+                    release(vm, x);
+                    if (sscanf(as_bytes(s), "%lf", &number) == 0)
+                    {
+                        bail(vm);
+                        fprintf(stderr, "error: failure at converting number!\n");
+                        fail(vm);
+                    }
+                    release(vm, s);
+
+                    as_numbers(r)[i] = number;
                 }
-                free(s);
+                release(vm, arr);
+                push(vm, r);
+                break;
             }
-            if (b.size > 0)
-                array_append(&r, b);
 
-            push(r);
-            free(delimiter);
-        }
+            case op_gt0:
+                push(vm, gt0(vm));
+                break;
 
-        else if (strcmp(current, "a2n") == 0)
-        {
-            value arr = pop();
-            if (is_string(arr)) 
-            {
-                value n = new_array(0);
-                array_append(&n, arr);
-                arr = n;
-            }
+            case op_lt0:
+                push(vm, lt0(vm));
+                break;
 
-            value r = new_array(0);
+            case op_binary_broadcast:
+                push(vm, binary_broadcast(vm));
+                break;
 
-            for (int i = 0; i < arr.size; i++) 
-            {
+            case op_unary_broadcast:
+                push(vm, unary_broadcast(vm));
+                break;
 
-                double number;
-                char* s = get_string(array_at(arr, i));
-                if (sscanf(s, "%lf", &number) == 0) 
-                {
-                    fprintf(stderr, "error: failure at converting number!\n");
-                    exit(1);
-                }
-                free(s);
+            case op_cos:
+                push(vm, _cos(vm));
+                break;
 
-                array_append(&r, new_constant(number));
-            }
-            push(r);
-        }
+            case op_sin:
+                push(vm, _sin(vm));
+                break;
 
-        else if (strcmp(current, ">0") == 0)
-        {
-            push(gt0());
-        }
+            case op_exp:
+                push(vm, _exp(vm));
+                break;
 
-        else if (strcmp(current, "<0") == 0)
-        {
-            push(lt0());
-        }
+            case op_log:
+                push(vm, _log(vm));
+                break;
 
-        else if (strcmp(current, "$:") == 0)
-        {
-            push(binary_broadcast());
-        }
+            case op_sqrt:
+                push(vm, _sqrt(vm));
+                break;
 
-        else if (strcmp(current, "$.") == 0)
-        {
-            push(unary_broadcast());
-        }
+            case op_tr:
+                push(vm, transpose(vm));
+                break;
 
-        else if (strcmp(current, "cos") == 0)
-        {
-            push(_cos());
-        }
+            case op_col:
+                push(vm, column(vm));
+                break;
 
-        else if (strcmp(current, "sin") == 0)
-        {
-            push(_sin());
-        }
+            case op_slc:
+                push(vm, slice(vm));
+                break;
 
-        else {
-            int idx;
-            if ((idx = find_var(current)) < 0) 
-            {
-                fprintf(stderr, "error: unrecognized token: \"%s\"!\n", current);
-                // fprintf(stderr, "available variables:\n");
-                // print_vars();
-                exit(1);
-            }
-            value v = var_data[idx];
-            if (v.type == nest && v.auto_exec) 
+            case op_nest_end:
+            case op_word:
             {
-                execute(v.data.nest, v.size);
-                continue;
+                symbol* var = &vm->symbols[current->token];
+                if (!var->defined)
+                {
+                    bail(vm);
+                    fprintf(stderr, "error: unrecognized token: \"%s\"!\n", symbol_name(vm, current->token));
+                    // fprintf(stderr, "available variables:\n");
+                    // print_vars();
+                    fail(vm);
+                }
+                value v = var->data;
+                if (var->auto_exec && type_of(v) == nest)
+                {
+                    execute(vm, as_nest(v), size_of(v));
+                    break;
+                }
+                push(vm, retain(v));
+                break;
             }
-            push(v);
         }
 
-    force_continue: {}
-
-        // favor não fazer nada aqui.
+        // favor não fazer nada aqui.
     }
 }
 
@@ -1847,85 +4808,149 @@ void print_usage()
         "options:\n"
         "   -h, --help\tprint this help text and exit.\n"
         "   -e, --eval\tevaluate string from the command line and exit.\n"
+        "   --gc-stats\tprint garbage collector statistics on exit.\n"
     );
 }
 
-void print_stack_and_quit() 
-{
-    fflush(stdout);
-    fflush(stderr);
-
-    fprintf(stderr, "SIGINT\n");
-    print_stack();
-    exit(1);
-}
-
-
-value tokenize(FILE* in) 
+int tokenize(s24_vm* vm, FILE* in, int** out) 
 {
 
     char buf[max_token_len];
-    value n = new_nest();
+    int* tokens = NULL;
+    int count = 0, capacity = 0;
 
     while (fscanf(in, "%255s", buf) == 1) 
-        nest_append(&n, buf);
+    {
+        if (count >= capacity)
+        {
+            capacity = capacity == 0 ? 1024 : capacity * 2;
+            tokens = realloc(tokens, sizeof(int) * capacity);
+        }
+        tokens[count++] = intern(vm, buf);
+    }
 
-    return n;
+    *out = tokens;
+    return count;
 }
 
-int run_from_stream(FILE* in) {
+// compila e roda. o código fica com a vm até o fim, as nests apontam pra ele.
+void load(s24_vm* vm, FILE* in)
+{
+    program* p = malloc(sizeof(program));
+    p->size = tokenize(vm, in, &p->tokens);
+    p->code = compile(vm, p->tokens, p->size);
+    p->prev = vm->programs;
+    vm->programs = p;
+    execute(vm, p->code, p->size);
+}
 
-    FILE* source_stream = in;
+// uma vm nova, já com a biblioteca padrão
+s24_vm* new_vm(FILE* out)
+{
+    s24_vm* vm = calloc(1, sizeof(s24_vm));
+    vm->gc.threshold = gc_initial_threshold;
+    vm->out = out;
 
-    // standard library
     FILE* std_in = fmemopen(std, std_len, "r");
-    value std_program = tokenize(std_in);
-    execute(std_program.data.nest, std_program.size);
+    load(vm, std_in);
+    fclose(std_in);
+    return vm;
+}
 
+// devolve tudo de uma vez: todo objeto vivo está na lista do coletor
+void free_vm(s24_vm* vm)
+{
+    for (object* o = vm->objects, *next; o != NULL; o = next)
+    {
+        next = o->next;
+        free(o);
+    }
+    for (chunk* c = vm->region, *prev; c != NULL; c = prev)
+    {
+        prev = c->prev;
+        free(c);
+    }
+    for (program* p = vm->programs, *prev; p != NULL; p = prev)
+    {
+        prev = p->prev;
+        free(p->code);
+        free(p->tokens);
+        free(p);
+    }
+    free(vm->symbols);
+    free(vm->symbol_names);
+    free(vm->symbol_slots);
+    free(vm->constants);
+    free(vm);
+}
 
-    // eval
-    value program = tokenize(source_stream);
-    execute(program.data.nest, program.size);
+// devolve 1 se o programa deu erro. o erro pode parar no meio de qualquer
+// builtin, então depois dele a vm só serve para free_vm.
+int run_from_stream(s24_vm* vm, FILE* in) {
 
+    jmp_buf fail;
+    if (setjmp(fail))
+    {
+        vm->fail = NULL;
+        return 1;
+    }
+    vm->fail = &fail;
 
+    // eval
+    load(vm, in);
+    vm->fail = NULL;
 
     // output
-    if (stack_size > 1) 
+    if (vm->stack_size > 1) 
     {
         fprintf(stderr, "error: stack remaining!\n");
-        print_stack();
+        print_stack(vm);
         return 1;
     }
-    else if (stack_size == 0) 
+    else if (vm->stack_size == 0) 
     {
         return 0;
     }
 
-    value last = pop();
-    if (last.type == operation)
-    {
-        fprintf(stderr, "error: lonely operation!\n");
-        print_stack();
-        return 1;
-    }
+    value last = pop(vm);
+    print_pretty_value(vm, last, false);
+    release(vm, last);
 
-    print_pretty_value(last, false);
+    return 0;
+}
 
+// cada chamada roda numa vm própria
+int run_from_string(char* string) {
+    s24_vm* vm = new_vm(stdout);
+    FILE* in = fmemopen(string, strlen(string), "r");
+    int r = run_from_stream(vm, in);
+    fclose(in);
+    free_vm(vm);
+    return r;
+}
 
-    free_value(program);
-    free_value(std_program);
+// o main tem uma vm só, e o ctrl-c e as estatísticas da saída usam ela
+s24_vm* main_vm = NULL;
 
+void print_stack_and_quit() 
+{
+    fflush(stdout);
+    fflush(stderr);
 
-    return 0;
+    fprintf(stderr, "SIGINT\n");
+    print_stack(main_vm);
+    exit(1);
 }
 
-int run_from_string(char* string) {
-    return run_from_stream(fmemopen(string, strlen(string), "r"));
+void print_main_gc_stats()
+{
+    print_gc_stats(main_vm);
 }
 
 int main(int argc, char** argv) 
 {
 
+    main_vm = new_vm(stdout);
     signal(SIGINT, print_stack_and_quit);
 
 
@@ -1947,6 +4972,13 @@ int main(int argc, char** argv)
             i++;
         }
 
+        else if (strcmp(argv[i], "--gc-stats") == 0)
+        {
+            if (!main_vm->gc.print)
+                atexit(print_main_gc_stats);
+            main_vm->gc.print = true;
+        }
+
         else if (*argv[i] == '-')
         {
             fprintf(stderr, "error: unrecognized option \"%s\"!\n", argv[i]);
@@ -1992,5 +5024,5 @@ int main(int argc, char** argv)
         exit(1);
     }
 
-    return run_from_stream(source_stream);
+    return run_from_stream(main_vm, source_stream);
 }